@@ -41,6 +41,7 @@ struct config {
   struct timeformat tf_base;		/* Time format for other purposes */
 
   int cli_debug;			/* Tracing of CLI connections and commands */
+  unsigned watchdog_warning;		/* Log hooks running longer than this (in ms, 0 = never) */
   char *err_msg;			/* Parser error message */
   int err_lino;				/* Line containing error */
   char *err_file_name;			/* File name containing error */
@@ -51,9 +51,58 @@ f_generate_complex(int operation, int operation_aux, struct f_inst *dyn, struct
   oper->a2.p = argument;
   set_dyn->code = P('e','S');
   set_dyn->a1.p = oper;
+  f_modifies = 1;
   return set_dyn;
 }
 
+struct f_roa_ref *f_roa_refs;	/* ROA tables used by the filter or function being parsed */
+int f_modifies;			/* The filter or function being parsed sets an attribute */
+
+static void
+f_add_roa_ref(struct roa_table_config *rtc)
+{
+  struct f_roa_ref *r;
+
+  for (r = f_roa_refs; r; r = r->next)
+    if (r->rtc == rtc)
+      return;
+
+  r = cfg_alloc(sizeof(struct f_roa_ref));
+  r->rtc = rtc;
+  r->next = f_roa_refs;
+  f_roa_refs = r;
+}
+
+/* Note the ROA tables used by a called function */
+void
+f_add_roa_refs(struct f_roa_ref *refs)
+{
+  for (; refs; refs = refs->next)
+    f_add_roa_ref(refs->rtc);
+}
+
+/**
+ * f_uses_roa_table - check whether a filter uses a ROA table
+ * @f: filter
+ * @t: ROA table
+ *
+ * Returns 1 if the filter @f calls roa_check() on the table @t, either
+ * directly or through a function, and 0 otherwise.
+ */
+int
+f_uses_roa_table(struct filter *f, struct roa_table *t)
+{
+  struct f_roa_ref *r;
+
+  if ((f == FILTER_ACCEPT) || (f == FILTER_REJECT))
+    return 0;
+
+  for (r = f->roa_tables; r; r = r->next)
+    if (r->rtc->table == t)
+      return 1;
+
+  return 0;
+}
 
 struct f_inst *
 f_generate_roa_check(struct symbol *sym, struct f_inst *prefix, struct f_inst *asn)
@@ -68,6 +117,7 @@ f_generate_roa_check(struct symbol *sym, struct f_inst *prefix, struct f_inst *a
   if ((sym->class != SYM_ROA) || ! sym->def)
     cf_error("%s is not a ROA table", sym->name);
   ret->rtc = sym->def;
+  f_add_roa_ref(ret->rtc);
 
   return &ret->i;
 }
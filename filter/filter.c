@@ -39,6 +39,7 @@
 #include "lib/socket.h"
 #include "lib/string.h"
 #include "lib/unaligned.h"
+#include "lib/perf.h"
 #include "nest/route.h"
 #include "nest/protocol.h"
 #include "nest/iface.h"
@@ -277,8 +278,20 @@ static inline int
 eclist_set_type(struct f_tree *set)
 { return set->from.type == T_EC; }
 
+/* Check whether the set contains given value, using compiled set if possible */
+static inline int
+set_contains(struct f_tree *set, struct f_val v)
+{
+  u64 key;
+
+  if (set->flat && (set->flat->type == v.type) && f_set_key(&v, &key))
+    return tree_flat_find(set->flat, key);
+
+  return !!find_tree(set, v);
+}
+
 static int
-clist_match_set(struct adata *clist, struct f_tree *set)
+clist_match_set(struct linpool *pool, struct adata *clist, struct f_tree *set)
 {
   if (!clist)
     return 0;
@@ -290,6 +303,23 @@ clist_match_set(struct adata *clist, struct f_tree *set)
   u32 *l = (u32 *) clist->data;
   u32 *end = l + clist->length/4;
 
+  if (set->flat && (set->flat->type == v.type)) {
+    int len = end - l;
+    u64 *keys;
+    int i;
+
+    if (!len)
+      return 0;
+
+    keys = lp_alloc(pool, len * sizeof(u64));
+
+    for (i = 0; i < len; i++) {
+      v.val.i = l[i];
+      f_set_key(&v, &keys[i]);
+    }
+    return tree_flat_find_any(set->flat, keys, len);
+  }
+
   while (l < end) {
     v.val.i = *l++;
     if (find_tree(set, v))
@@ -299,7 +329,7 @@ clist_match_set(struct adata *clist, struct f_tree *set)
 }
 
 static int
-eclist_match_set(struct adata *list, struct f_tree *set)
+eclist_match_set(struct linpool *pool, struct adata *list, struct f_tree *set)
 {
   if (!list)
     return 0;
@@ -312,6 +342,19 @@ eclist_match_set(struct adata *list, struct f_tree *set)
   int len = int_set_get_size(list);
   int i;
 
+  if (set->flat && (set->flat->type == T_EC)) {
+    u64 *keys;
+
+    if (len < 2)
+      return 0;
+
+    keys = lp_alloc(pool, (len / 2) * sizeof(u64));
+
+    for (i = 0; i < len / 2; i++)
+      keys[i] = ec_get(l, 2*i);
+    return tree_flat_find_any(set->flat, keys, len / 2);
+  }
+
   v.type = T_EC;
   for (i = 0; i < len; i += 2) {
     v.val.ec = ec_get(l, i);
@@ -344,7 +387,7 @@ clist_filter(struct linpool *pool, struct adata *list, struct f_val set, int pos
   while (l < end) {
     v.val.i = *l++;
     /* pos && member(val, set) || !pos && !member(val, set),  member() depends on tree */
-    if ((tree ? !!find_tree(set.val.t, v) : int_set_contains(set.val.ad, v.val.i)) == pos)
+    if ((tree ? set_contains(set.val.t, v) : int_set_contains(set.val.ad, v.val.i)) == pos)
       *k++ = v.val.i;
   }
 
@@ -376,7 +419,7 @@ eclist_filter(struct linpool *pool, struct adata *list, struct f_val set, int po
   for (i = 0; i < len; i += 2) {
     v.val.ec = ec_get(l, i);
     /* pos && member(val, set) || !pos && !member(val, set),  member() depends on tree */
-    if ((tree ? !!find_tree(set.val.t, v) : ec_set_contains(set.val.ad, v.val.ec)) == pos) {
+    if ((tree ? set_contains(set.val.t, v) : ec_set_contains(set.val.ad, v.val.ec)) == pos) {
       *k++ = l[i];
       *k++ = l[i+1];
     }
@@ -393,6 +436,7 @@ eclist_filter(struct linpool *pool, struct adata *list, struct f_val set, int po
 
 /**
  * val_in_range - implement |~| operator
+ * @pool: linpool for temporary data
  * @v1: element
  * @v2: set
  *
@@ -400,7 +444,7 @@ eclist_filter(struct linpool *pool, struct adata *list, struct f_val set, int po
  * |tree.c| module (this is not limited to sets, but for non-set cases, val_simple_in_range() is called early).
  */
 static int
-val_in_range(struct f_val v1, struct f_val v2)
+val_in_range(struct linpool *pool, struct f_val v1, struct f_val v2)
 {
   int res;
 
@@ -413,10 +457,10 @@ val_in_range(struct f_val v1, struct f_val v2)
     return trie_match_fprefix(v2.val.ti, &v1.val.px);
 
   if ((v1.type == T_CLIST) && (v2.type == T_SET))
-    return clist_match_set(v1.val.ad, v2.val.t);
+    return clist_match_set(pool, v1.val.ad, v2.val.t);
 
   if ((v1.type == T_ECLIST) && (v2.type == T_SET))
-    return eclist_match_set(v1.val.ad, v2.val.t);
+    return eclist_match_set(pool, v1.val.ad, v2.val.t);
 
   if (v2.type == T_SET)
     switch (v1.type) {
@@ -428,6 +472,11 @@ val_in_range(struct f_val v1, struct f_val v2)
     case T_EC:
       {
 	struct f_tree *n;
+	u64 key;
+
+	if (v2.val.t->flat && (v2.val.t->flat->type == v1.type) && f_set_key(&v1, &key))
+	  return tree_flat_find(v2.val.t->flat, key);
+
 	n = find_tree(v2.val.t, v1);
 	if (!n)
 	  return 0;
@@ -496,45 +545,81 @@ val_print(struct f_val v)
   }
 }
 
-static struct rte **f_rte;
-static struct rta *f_old_rta;
-static struct ea_list **f_tmp_attrs;
-static struct linpool *f_pool;
-static int f_flags;
-
-static inline void f_rte_cow(void)
+static inline void f_rte_cow(struct filter_state *fs)
 {
-  *f_rte = rte_cow(*f_rte); 
+  *fs->rte = rte_cow(*fs->rte); 
 }
 
 /*
  * rta_cow - prepare rta for modification by filter
  */
 static void
-f_rta_cow(void)
+f_rta_cow(struct filter_state *fs)
 {
-  if ((*f_rte)->attrs->aflags & RTAF_CACHED) {
+  if ((*fs->rte)->attrs->aflags & RTAF_CACHED) {
 
     /* Prepare to modify rte */
-    f_rte_cow();
+    f_rte_cow(fs);
 
     /* Store old rta to free it later */
-    f_old_rta = (*f_rte)->attrs;
+    fs->old_rta = (*fs->rte)->attrs;
 
     /* 
      * Alloc new rta, do shallow copy and update rte. Fields eattrs
-     * and nexthops of rta are shared with f_old_rta (they will be
+     * and nexthops of rta are shared with fs->old_rta (they will be
      * copied when the cached rta will be obtained at the end of
      * f_run()), also the lock of hostentry is inherited (we suppose
      * hostentry is not changed by filters).
      */
-    rta *ra = lp_alloc(f_pool, sizeof(rta));
-    memcpy(ra, f_old_rta, sizeof(rta));
+    rta *ra = lp_alloc(fs->pool, sizeof(rta));
+    memcpy(ra, fs->old_rta, sizeof(rta));
     ra->aflags = 0;
-    (*f_rte)->attrs = ra;
+    (*fs->rte)->attrs = ra;
   }
 }
 
+static struct f_val interpret(struct filter_state *fs, struct f_inst *what);
+
+/*
+ * f_resolve_path_mask - evaluate ASN expressions of a path mask
+ *
+ * Path masks may contain PM_ASN_EXPR items, which have to be evaluated
+ * with the context of the running filter. Such masks are copied to the
+ * temporary pool with the expressions replaced by their values, masks
+ * without expressions are returned unchanged.
+ */
+static struct f_path_mask *
+f_resolve_path_mask(struct filter_state *fs, struct f_path_mask *mask)
+{
+  struct f_path_mask *m, *res, **last = &res;
+
+  for (m = mask; m; m = m->next)
+    if (m->kind == PM_ASN_EXPR)
+      break;
+
+  if (!m)
+    return mask;
+
+  for (m = mask; m; m = m->next)
+  {
+    struct f_path_mask *n = lp_alloc(fs->pool, sizeof(struct f_path_mask));
+    *n = *m;
+
+    if (m->kind == PM_ASN_EXPR)
+    {
+      struct f_val v = interpret(fs, (struct f_inst *) m->val);
+      n->kind = PM_ASN;
+      n->val = (v.type == T_INT) ? v.val.i : 0;
+    }
+
+    *last = n;
+    last = &n->next;
+  }
+
+  *last = NULL;
+  return res;
+}
+
 static struct rate_limit rl_runtime_err;
 
 #define runtime(x) do { \
@@ -545,7 +630,7 @@ static struct rate_limit rl_runtime_err;
   } while(0)
 
 #define ARG(x,y) \
-	x = interpret(what->y); \
+	x = interpret(fs, what->y); \
 	if (x.type & T_RETURN) \
 		return x;
 
@@ -558,6 +643,7 @@ static struct rate_limit rl_runtime_err;
 
 /**
  * interpret
+ * @fs: filter execution context
  * @what: filter to interpret
  *
  * Interpret given tree of filter instructions. This is core function
@@ -571,10 +657,11 @@ static struct rate_limit rl_runtime_err;
  * TWOARGS macro to get both of them evaluated.
  *
  * &f_val structures are copied around, so there are no problems with
- * memory managment.
+ * memory managment. All state related to the filtered route is kept
+ * in @fs, so independent filter runs do not interfere with each other.
  */
 static struct f_val
-interpret(struct f_inst *what)
+interpret(struct filter_state *fs, struct f_inst *what)
 {
   struct symbol *sym;
   struct f_val v1, v2, res, *vp;
@@ -733,7 +820,7 @@ interpret(struct f_inst *what)
   case '~':
     TWOARGS;
     res.type = T_BOOL;
-    res.val.i = val_in_range(v1, v2);
+    res.val.i = val_in_range(fs->pool, v1, v2);
     if (res.val.i == CMP_ERROR)
       runtime( "~ applied on unknown type pair" );
     res.val.i = !!res.val.i;
@@ -779,6 +866,8 @@ interpret(struct f_inst *what)
   case 'V':
   case 'C':
     res = * ((struct f_val *) what->a1.p);
+    if ((what->code == 'C') && (res.type == T_PATH_MASK))
+      res.val.path_mask = f_resolve_path_mask(fs, res.val.path_mask);
     break;
   case 'p':
     ONEARG;
@@ -821,7 +910,7 @@ interpret(struct f_inst *what)
     break;
   case 'a':	/* rta access */
     {
-      struct rta *rta = (*f_rte)->attrs;
+      struct rta *rta = (*fs->rte)->attrs;
       res.type = what->aux;
       switch(res.type) {
       case T_IP:
@@ -835,8 +924,8 @@ interpret(struct f_inst *what)
 	break;
       case T_PREFIX:	/* Warning: this works only for prefix of network */
 	{
-	  res.val.px.ip = (*f_rte)->net->n.prefix;
-	  res.val.px.len = (*f_rte)->net->n.pxlen;
+	  res.val.px.ip = (*fs->rte)->net->n.prefix;
+	  res.val.px.len = (*fs->rte)->net->n.pxlen;
 	  break;
 	}
       default:
@@ -848,9 +937,9 @@ interpret(struct f_inst *what)
     ONEARG;
     if (what->aux != v1.type)
       runtime( "Attempt to set static attribute to incompatible type" );
-    f_rta_cow();
+    f_rta_cow(fs);
     {
-      struct rta *rta = (*f_rte)->attrs;
+      struct rta *rta = (*fs->rte)->attrs;
       switch (what->aux) {
 
       case T_IP:
@@ -879,24 +968,24 @@ interpret(struct f_inst *what)
   case P('e','a'):	/* Access to extended attributes */
     {
       eattr *e = NULL;
-      if (!(f_flags & FF_FORCE_TMPATTR))
-	e = ea_find( (*f_rte)->attrs->eattrs, what->a2.i );
+      if (!(fs->flags & FF_FORCE_TMPATTR))
+	e = ea_find( (*fs->rte)->attrs->eattrs, what->a2.i );
       if (!e) 
-	e = ea_find( (*f_tmp_attrs), what->a2.i );
-      if ((!e) && (f_flags & FF_FORCE_TMPATTR))
-	e = ea_find( (*f_rte)->attrs->eattrs, what->a2.i );
+	e = ea_find( (*fs->tmp_attrs), what->a2.i );
+      if ((!e) && (fs->flags & FF_FORCE_TMPATTR))
+	e = ea_find( (*fs->rte)->attrs->eattrs, what->a2.i );
 
       if (!e) {
 	/* A special case: undefined int_set looks like empty int_set */
 	if ((what->aux & EAF_TYPE_MASK) == EAF_TYPE_INT_SET) {
 	  res.type = T_CLIST;
-	  res.val.ad = adata_empty(f_pool, 0);
+	  res.val.ad = adata_empty(fs->pool, 0);
 	  break;
 	}
 	/* The same special case for ec_set */
 	else if ((what->aux & EAF_TYPE_MASK) == EAF_TYPE_EC_SET) {
 	  res.type = T_ECLIST;
-	  res.val.ad = adata_empty(f_pool, 0);
+	  res.val.ad = adata_empty(fs->pool, 0);
 	  break;
 	}
 
@@ -946,7 +1035,7 @@ interpret(struct f_inst *what)
   case P('e','S'):
     ONEARG;
     {
-      struct ea_list *l = lp_alloc(f_pool, sizeof(struct ea_list) + sizeof(eattr));
+      struct ea_list *l = lp_alloc(fs->pool, sizeof(struct ea_list) + sizeof(eattr));
 
       l->next = NULL;
       l->flags = EALF_SORTED;
@@ -968,7 +1057,7 @@ interpret(struct f_inst *what)
 	if (v1.type != T_IP)
 	  runtime( "Setting ip attribute to non-ip value" );
 	int len = sizeof(ip_addr);
-	struct adata *ad = lp_alloc(f_pool, sizeof(struct adata) + len);
+	struct adata *ad = lp_alloc(fs->pool, sizeof(struct adata) + len);
 	ad->length = len;
 	(* (ip_addr *) ad->data) = v1.val.px.ip;
 	l->attrs[0].u.ptr = ad;
@@ -996,19 +1085,19 @@ interpret(struct f_inst *what)
       default: bug("Unknown type in e,S");
       }
 
-      if (!(what->aux & EAF_TEMP) && (!(f_flags & FF_FORCE_TMPATTR))) {
-	f_rta_cow();
-	l->next = (*f_rte)->attrs->eattrs;
-	(*f_rte)->attrs->eattrs = l;
+      if (!(what->aux & EAF_TEMP) && (!(fs->flags & FF_FORCE_TMPATTR))) {
+	f_rta_cow(fs);
+	l->next = (*fs->rte)->attrs->eattrs;
+	(*fs->rte)->attrs->eattrs = l;
       } else {
-	l->next = (*f_tmp_attrs);
-	(*f_tmp_attrs) = l;
+	l->next = (*fs->tmp_attrs);
+	(*fs->tmp_attrs) = l;
       }
     }
     break;
   case 'P':
     res.type = T_INT;
-    res.val.i = (*f_rte)->pref;
+    res.val.i = (*fs->rte)->pref;
     break;
   case P('P','S'):
     ONEARG;
@@ -1016,8 +1105,8 @@ interpret(struct f_inst *what)
       runtime( "Can't set preference to non-integer" );
     if ((v1.val.i < 0) || (v1.val.i > 0xFFFF))
       runtime( "Setting preference value out of bounds" );
-    f_rte_cow();
-    (*f_rte)->pref = v1.val.i;
+    f_rte_cow(fs);
+    (*fs->rte)->pref = v1.val.i;
     break;
   case 'L':	/* Get length of */
     ONEARG;
@@ -1066,7 +1155,7 @@ interpret(struct f_inst *what)
     return res;
   case P('c','a'): /* CALL: this is special: if T_RETURN and returning some value, mask it out  */
     ONEARG;
-    res = interpret(what->a2.p);
+    res = interpret(fs, what->a2.p);
     if (res.type == T_RETURN)
       return res;
     res.type &= ~T_RETURN;    
@@ -1089,7 +1178,7 @@ interpret(struct f_inst *what)
       }	
       /* It is actually possible to have t->data NULL */
 
-      res = interpret(t->data);
+      res = interpret(fs, t->data);
       if (res.type & T_RETURN)
 	return res;
     }
@@ -1109,7 +1198,7 @@ interpret(struct f_inst *what)
 
   case 'E':	/* Create empty attribute */
     res.type = what->aux;
-    res.val.ad = adata_empty(f_pool, 0);
+    res.val.ad = adata_empty(fs->pool, 0);
     break;
   case P('A','p'):	/* Path prepend */
     TWOARGS;
@@ -1119,7 +1208,7 @@ interpret(struct f_inst *what)
       runtime("Can't prepend non-integer");
 
     res.type = T_PATH;
-    res.val.ad = as_path_prepend(f_pool, v1.val.ad, v2.val.i);
+    res.val.ad = as_path_prepend(v1.val.ad, v2.val.i);
     break;
 
   case P('C','a'):	/* (Extended) Community list add or delete */
@@ -1152,22 +1241,22 @@ interpret(struct f_inst *what)
 	if (arg_set == 1)
 	  runtime("Can't add set");
 	else if (!arg_set)
-	  res.val.ad = int_set_add(f_pool, v1.val.ad, i);
+	  res.val.ad = int_set_add(v1.val.ad, i);
 	else 
-	  res.val.ad = int_set_union(f_pool, v1.val.ad, v2.val.ad);
+	  res.val.ad = int_set_union(fs->pool, v1.val.ad, v2.val.ad);
 	break;
       
       case 'd':
 	if (!arg_set)
-	  res.val.ad = int_set_del(f_pool, v1.val.ad, i);
+	  res.val.ad = int_set_del(fs->pool, v1.val.ad, i);
 	else
-	  res.val.ad = clist_filter(f_pool, v1.val.ad, v2, 0);
+	  res.val.ad = clist_filter(fs->pool, v1.val.ad, v2, 0);
 	break;
 
       case 'f':
 	if (!arg_set)
 	  runtime("Can't filter pair");
-	res.val.ad = clist_filter(f_pool, v1.val.ad, v2, 1);
+	res.val.ad = clist_filter(fs->pool, v1.val.ad, v2, 1);
 	break;
 
       default:
@@ -1194,22 +1283,22 @@ interpret(struct f_inst *what)
 	if (arg_set == 1)
 	  runtime("Can't add set");
 	else if (!arg_set)
-	  res.val.ad = ec_set_add(f_pool, v1.val.ad, v2.val.ec);
+	  res.val.ad = ec_set_add(v1.val.ad, v2.val.ec);
 	else 
-	  res.val.ad = ec_set_union(f_pool, v1.val.ad, v2.val.ad);
+	  res.val.ad = ec_set_union(fs->pool, v1.val.ad, v2.val.ad);
 	break;
       
       case 'd':
 	if (!arg_set)
-	  res.val.ad = ec_set_del(f_pool, v1.val.ad, v2.val.ec);
+	  res.val.ad = ec_set_del(fs->pool, v1.val.ad, v2.val.ec);
 	else
-	  res.val.ad = eclist_filter(f_pool, v1.val.ad, v2, 0);
+	  res.val.ad = eclist_filter(fs->pool, v1.val.ad, v2, 0);
 	break;
 
       case 'f':
 	if (!arg_set)
 	  runtime("Can't filter ec");
-	res.val.ad = eclist_filter(f_pool, v1.val.ad, v2, 1);
+	res.val.ad = eclist_filter(fs->pool, v1.val.ad, v2, 1);
 	break;
 
       default:
@@ -1232,12 +1321,12 @@ interpret(struct f_inst *what)
     }
     else
     {
-      v1.val.px.ip = (*f_rte)->net->n.prefix;
-      v1.val.px.len = (*f_rte)->net->n.pxlen;
+      v1.val.px.ip = (*fs->rte)->net->n.prefix;
+      v1.val.px.len = (*fs->rte)->net->n.pxlen;
 
       /* We ignore temporary attributes, probably not a problem here */
       /* 0x02 is a value of BA_AS_PATH, we don't want to include BGP headers */
-      eattr *e = ea_find((*f_rte)->attrs->eattrs, EA_CODE(EAP_BGP, 0x02));
+      eattr *e = ea_find((*fs->rte)->attrs->eattrs, EA_CODE(EAP_BGP, 0x02));
 
       if (!e || e->type != EAF_TYPE_AS_PATH)
 	runtime("Missing AS_PATH attribute");
@@ -1257,7 +1346,7 @@ interpret(struct f_inst *what)
     bug( "Unknown instruction %d (%c)", what->code, what->code & 0xff);
   }
   if (what->next)
-    return interpret(what->next);
+    return interpret(fs, what->next);
   return res;
 }
 
@@ -1391,64 +1480,48 @@ i_same(struct f_inst *f1, struct f_inst *f2)
 }
 
 /**
- * f_run - run a filter for a route
+ * f_run_state - run a filter in a given execution context
  * @filter: filter to run
- * @rte: route being filtered, may be modified
- * @tmp_attrs: temporary attributes, prepared by caller or generated by f_run()
- * @tmp_pool: all filter allocations go from this pool
- * @flags: flags
+ * @fs: execution context; route, temporary attributes, pool and
+ * flags must be filled in by the caller
  *
- * If filter needs to modify the route, there are several
- * posibilities. @rte might be read-only (with REF_COW flag), in that
- * case rw copy is obtained by rte_cow() and @rte is replaced. If
- * @rte is originally rw, it may be directly modified (and it is never
- * copied).
- *
- * The returned rte may reuse the (possibly cached, cloned) rta, or
- * (if rta was modificied) contains a modified uncached rta, which
- * uses parts allocated from @tmp_pool and parts shared from original
- * rta. There is one exception - if @rte is rw but contains a cached
- * rta and that is modified, rta in returned rte is also cached.
- *
- * Ownership of cached rtas is consistent with rte, i.e.
- * if a new rte is returned, it has its own clone of cached rta
- * (and cached rta of read-only source rte is intact), if rte is
- * modified in place, old cached rta is possibly freed.
+ * This is the reentrant core of f_run(). All route related state is
+ * kept in @fs, so filters for different routes may be evaluated
+ * independently, each with its own context and temporary pool.
+ * Semantics of route modification are the same as in f_run().
  */
 int
-f_run(struct filter *filter, struct rte **rte, struct ea_list **tmp_attrs, struct linpool *tmp_pool, int flags)
+f_run_state(struct filter *filter, struct filter_state *fs)
 {
-  int rte_cow = ((*rte)->flags & REF_COW);
+  int rte_cow = ((*fs->rte)->flags & REF_COW);
+  u64 start = perf_start();
   DBG( "Running filter `%s'...", filter->name );
 
-  f_rte = rte;
-  f_old_rta = NULL;
-  f_tmp_attrs = tmp_attrs;
-  f_pool = tmp_pool;
-  f_flags = flags;
+  fs->old_rta = NULL;
 
   log_reset();
-  struct f_val res = interpret(filter->root);
+  struct f_val res = interpret(fs, filter->root);
 
-  if (f_old_rta) {
+  if (fs->old_rta) {
     /*
-     * Cached rta was modified and f_rte contains now an uncached one,
+     * Cached rta was modified and route contains now an uncached one,
      * sharing some part with the cached one. The cached rta should
-     * be freed (if rte was originally COW, f_old_rta is a clone
+     * be freed (if rte was originally COW, old_rta is a clone
      * obtained during rte_cow()).
      *
      * This also implements the exception mentioned in f_run()
      * description. The reason for this is that rta reuses parts of
-     * f_old_rta, and these may be freed during rta_free(f_old_rta).
+     * old_rta, and these may be freed during rta_free(old_rta).
      * This is not the problem if rte was COW, because original rte
      * also holds the same rta.
      */
     if (!rte_cow)
-      (*f_rte)->attrs = rta_lookup((*f_rte)->attrs);
+      (*fs->rte)->attrs = rta_lookup((*fs->rte)->attrs);
 
-    rta_free(f_old_rta);
+    rta_free(fs->old_rta);
   }
 
+  perf_end(PERF_FILTER, start);
 
   if (res.type != T_RETURN) {
     log( L_ERR "Filter %s did not return accept nor reject. Make up your mind", filter->name); 
@@ -1458,19 +1531,53 @@ f_run(struct filter *filter, struct rte **rte, struct ea_list **tmp_attrs, struc
   return res.val.i;
 }
 
+/**
+ * f_run - run a filter for a route
+ * @filter: filter to run
+ * @rte: route being filtered, may be modified
+ * @tmp_attrs: temporary attributes, prepared by caller or generated by f_run()
+ * @tmp_pool: all filter allocations go from this pool
+ * @flags: flags
+ *
+ * If filter needs to modify the route, there are several
+ * posibilities. @rte might be read-only (with REF_COW flag), in that
+ * case rw copy is obtained by rte_cow() and @rte is replaced. If
+ * @rte is originally rw, it may be directly modified (and it is never
+ * copied).
+ *
+ * The returned rte may reuse the (possibly cached, cloned) rta, or
+ * (if rta was modificied) contains a modified uncached rta, which
+ * uses parts allocated from @tmp_pool and parts shared from original
+ * rta. There is one exception - if @rte is rw but contains a cached
+ * rta and that is modified, rta in returned rte is also cached.
+ *
+ * Ownership of cached rtas is consistent with rte, i.e.
+ * if a new rte is returned, it has its own clone of cached rta
+ * (and cached rta of read-only source rte is intact), if rte is
+ * modified in place, old cached rta is possibly freed.
+ */
+int
+f_run(struct filter *filter, struct rte **rte, struct ea_list **tmp_attrs, struct linpool *tmp_pool, int flags)
+{
+  struct filter_state fs = {
+    .rte = rte,
+    .tmp_attrs = tmp_attrs,
+    .pool = tmp_pool,
+    .flags = flags
+  };
+
+  return f_run_state(filter, &fs);
+}
+
 int
 f_eval_int(struct f_inst *expr)
 {
   /* Called independently in parse-time to eval expressions */
+  struct filter_state fs = { .pool = cfg_mem };
   struct f_val res;
 
-  f_flags = 0;
-  f_tmp_attrs = NULL;
-  f_rte = NULL;
-  f_pool = cfg_mem;
-
   log_reset();
-  res = interpret(expr);
+  res = interpret(&fs, expr);
 
   if (res.type != T_INT)
     cf_error("Integer expression expected");
@@ -1480,8 +1587,13 @@ f_eval_int(struct f_inst *expr)
 u32
 f_eval_asn(struct f_inst *expr)
 {
-  /* Called as a part of another interpret call, therefore no log_reset() */
-  struct f_val res = interpret(expr);
+  /*
+   * Called from as_path_match() and pm_format() without filter context,
+   * therefore no log_reset() and no route. Masks used in running filters
+   * are resolved by f_resolve_path_mask() with the proper context.
+   */
+  struct filter_state fs = { };
+  struct f_val res = interpret(&fs, expr);
   return (res.type == T_INT) ? res.val.i : 0;
 }
 
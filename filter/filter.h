@@ -63,9 +63,16 @@ struct f_val {
   } val;
 };
 
+struct f_roa_ref {			/* ROA table used by a filter */
+  struct roa_table_config *rtc;
+  struct f_roa_ref *next;
+};
+
 struct filter {
   char *name;
   struct f_inst *root;
+  struct f_roa_ref *roa_tables;		/* ROA tables the filter calls roa_check() on, possibly through a function */
+  int modifies;				/* Filter may change route attributes, possibly through a function */
 };
 
 struct f_inst *f_new_inst(void);
@@ -73,15 +80,24 @@ struct f_inst *f_new_dynamic_attr(int type, int f_type, int code);	/* Type as co
 struct f_tree *f_new_tree(void);
 struct f_inst *f_generate_complex(int operation, int operation_aux, struct f_inst *dyn, struct f_inst *argument);
 struct f_inst *f_generate_roa_check(struct symbol *sym, struct f_inst *prefix, struct f_inst *asn);
+extern struct f_roa_ref *f_roa_refs;
+extern int f_modifies;
+void f_add_roa_refs(struct f_roa_ref *refs);
+int f_uses_roa_table(struct filter *f, struct roa_table *t);
 
 
+struct f_tree_flat;
 struct f_tree *build_tree(struct f_tree *);
 struct f_tree *find_tree(struct f_tree *t, struct f_val val);
 int same_tree(struct f_tree *t1, struct f_tree *t2);
+void tree_compile(struct f_tree *t);
+int tree_flat_find(struct f_tree_flat *f, u64 key);
+int tree_flat_find_any(struct f_tree_flat *f, u64 *keys, int n);
 
 struct f_trie *f_new_trie(linpool *lp);
 void trie_add_prefix(struct f_trie *t, ip_addr px, int plen, int l, int h);
 int trie_match_prefix(struct f_trie *t, ip_addr px, int plen);
+void trie_compile(struct f_trie *t);
 int trie_same(struct f_trie *t1, struct f_trie *t2);
 void trie_print(struct f_trie *t);
 
@@ -105,6 +121,15 @@ trie_match_fprefix(struct f_trie *t, struct f_prefix *px)
 struct ea_list;
 struct rte;
 
+struct filter_state {		/* Execution context of a running filter */
+  struct rte **rte;		/* Route being filtered, may be replaced by rte_cow() */
+  struct rta *old_rta;		/* Cached rta replaced by modified uncached one */
+  struct ea_list **tmp_attrs;	/* Temporary attributes */
+  struct linpool *pool;		/* Pool for all filter allocations */
+  int flags;			/* FF_* flags */
+};
+
+int f_run_state(struct filter *filter, struct filter_state *fs);
 int f_run(struct filter *filter, struct rte **rte, struct ea_list **tmp_attrs, struct linpool *tmp_pool, int flags);
 int f_eval_int(struct f_inst *expr);
 u32 f_eval_asn(struct f_inst *expr);
@@ -173,8 +198,43 @@ struct f_tree {
   struct f_tree *left, *right;
   struct f_val from, to;
   void *data;
+  struct f_tree_flat *flat;		/* Compiled set, only in root, see tree_compile() */
 };
 
+struct f_tree_flat {			/* Compiled set of integer values */
+  int type;				/* Type of all values in the set */
+  int count;				/* Number of ranges */
+  u64 *from, *to;			/* Sorted disjoint ranges of keys, inclusive */
+  u32 *bitmap;				/* Bitmap of keys from @base, NULL if not dense */
+  u64 base;
+  u32 bits;				/* Number of keys covered by @bitmap */
+};
+
+/*
+ * Order-preserving mapping of simple values to keys of compiled sets.
+ * Returns 0 for types which are not supported there.
+ */
+static inline int
+f_set_key(struct f_val *v, u64 *key)
+{
+  switch (v->type)
+  {
+  case T_INT:
+  case T_ENUM:
+    *key = ((u32) v->val.i) ^ 0x80000000;	/* Signed comparison */
+    return 1;
+  case T_PAIR:
+  case T_QUAD:
+    *key = (u32) v->val.i;
+    return 1;
+  case T_EC:
+    *key = v->val.ec;
+    return 1;
+  default:
+    return 0;
+  }
+}
+
 struct f_trie_node
 {
   ip_addr addr, mask, accept;
@@ -182,10 +242,19 @@ struct f_trie_node
   struct f_trie_node *c[2];
 };
 
+struct f_trie_fnode			/* Node of compiled trie, see trie_compile() */
+{
+  ip_addr addr, mask, accept;
+  u16 plen;
+  u16 left;				/* Left child immediately follows */
+  u32 right;				/* Index of right child, 0 if none */
+};
+
 struct f_trie
 {
   linpool *lp;
   int zero;
+  struct f_trie_fnode *flat;		/* Compiled trie, NULL if not compiled */
   struct f_trie_node root;
 };
 
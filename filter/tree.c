@@ -103,9 +103,193 @@ f_new_tree(void)
   ret->from.type = ret->to.type = T_VOID;
   ret->from.val.i = ret->to.val.i = 0;
   ret->data = NULL;
+  ret->flat = NULL;
   return ret;
 }
 
+static int
+tree_count(struct f_tree *t)
+{
+  return t ? 1 + tree_count(t->left) + tree_count(t->right) : 0;
+}
+
+static int
+tree_fill_keys(struct f_tree *t, int type, u64 *from, u64 *to, int pos)
+{
+  if (!t)
+    return pos;
+
+  pos = tree_fill_keys(t->left, type, from, to, pos);
+  if (pos < 0)
+    return pos;
+
+  if ((t->from.type != type) || (t->to.type != type) ||
+      !f_set_key(&t->from, &from[pos]) || !f_set_key(&t->to, &to[pos]))
+    return -1;
+  pos++;
+
+  return tree_fill_keys(t->right, type, from, to, pos);
+}
+
+/**
+ * tree_compile
+ * @t: set built by build_tree()
+ *
+ * Builds compiled form of a set of simple values (integers, pairs,
+ * quads, enums and extended communities) and attaches it to the root
+ * node of @t. Ranges of the set are stored as sorted arrays of keys
+ * with overlapping and adjacent ranges merged, so membership test is
+ * a branch-free binary search over a contiguous array. Dense sets are
+ * represented by a bitmap instead. Sets with values of other types or
+ * of mixed types are left as they are and find_tree() is used for them.
+ */
+void
+tree_compile(struct f_tree *t)
+{
+  struct f_tree_flat *f;
+  int len, i, j;
+
+  if (!t)
+    return;
+
+  len = tree_count(t);
+  u64 *from = cfg_alloc(len * sizeof(u64));
+  u64 *to = cfg_alloc(len * sizeof(u64));
+
+  if (tree_fill_keys(t, t->from.type, from, to, 0) < 0)
+    return;
+
+  /* In-order walk gives ranges sorted by lower bound, merge overlapping ones */
+  for (i = 0, j = 0; i < len; i++)
+    {
+      if (from[i] > to[i])
+	continue;
+
+      if (j && ((to[j-1] == ~((u64) 0)) || (from[i] <= to[j-1] + 1)))
+	{
+	  if (to[i] > to[j-1])
+	    to[j-1] = to[i];
+	  continue;
+	}
+
+      from[j] = from[i];
+      to[j] = to[i];
+      j++;
+    }
+
+  f = cfg_allocz(sizeof(struct f_tree_flat));
+  f->type = t->from.type;
+  f->count = j;
+  f->from = from;
+  f->to = to;
+
+  /* Use bitmap if it is not larger than the arrays of keys */
+  if (j > 1)
+    {
+      u64 span = to[j-1] - from[0];
+      if (span < 128 * (u64) j)
+	{
+	  f->base = from[0];
+	  f->bits = span + 1;
+	  f->bitmap = cfg_allocz(BIRD_ALIGN(f->bits, 32) / 8);
+
+	  for (i = 0; i < j; i++)
+	    {
+	      u64 k;
+	      for (k = from[i] - f->base; k <= to[i] - f->base; k++)
+		f->bitmap[k / 32] |= 1U << (k % 32);
+	    }
+	}
+    }
+
+  t->flat = f;
+}
+
+/* Index of the first range which ends at @key or later, starting at @pos */
+static inline int
+tree_flat_lower(struct f_tree_flat *f, int pos, u64 key)
+{
+  u64 *base = f->to + pos;
+  int n = f->count - pos;
+
+  if (n <= 0)
+    return f->count;
+
+  while (n > 1)
+    {
+      int half = n / 2;
+      base = (base[half] < key) ? base + half : base;
+      n -= half;
+    }
+
+  return (base - f->to) + (*base < key);
+}
+
+/**
+ * tree_flat_find
+ * @f: compiled set
+ * @key: key of the value, see f_set_key()
+ *
+ * Returns 1 if the value with key @key is in the set.
+ */
+int
+tree_flat_find(struct f_tree_flat *f, u64 key)
+{
+  if (f->bitmap)
+    {
+      u64 k = key - f->base;
+      return (key >= f->base) && (k < f->bits) && (f->bitmap[k / 32] & (1U << (k % 32)));
+    }
+
+  int i = tree_flat_lower(f, 0, key);
+  return (i < f->count) && (f->from[i] <= key);
+}
+
+static int
+u64_compare(const void *p1, const void *p2)
+{
+  u64 a = * (u64 *) p1, b = * (u64 *) p2;
+  return (a > b) - (a < b);
+}
+
+/**
+ * tree_flat_find_any
+ * @f: compiled set
+ * @keys: keys of values, the array is reordered
+ * @n: number of keys
+ *
+ * Returns 1 if any of values with keys @keys is in the set. Larger
+ * lists are sorted and matched against the set as a merge-join, so
+ * every range of the set is examined at most once.
+ */
+int
+tree_flat_find_any(struct f_tree_flat *f, u64 *keys, int n)
+{
+  int i, pos;
+
+  if (f->bitmap || (n < 4))
+    {
+      for (i = 0; i < n; i++)
+	if (tree_flat_find(f, keys[i]))
+	  return 1;
+      return 0;
+    }
+
+  qsort(keys, n, sizeof(u64), u64_compare);
+
+  for (i = 0, pos = 0; i < n; i++)
+    {
+      pos = tree_flat_lower(f, pos, keys[i]);
+      if (pos >= f->count)
+	return 0;
+
+      if (f->from[pos] <= keys[i])
+	return 1;
+    }
+
+  return 0;
+}
+
 /**
  * same_tree
  * @t1: first tree to be compared
@@ -67,6 +67,14 @@
  *
  * The walking code in trie_match_prefix() is structured according to
  * these cases.
+ *
+ * Tries that are no longer modified (e.g. prefix set constants in
+ * filters) may be compiled by trie_compile() to an array of nodes
+ * stored in DFS order. Left child of a node immediately follows it
+ * and right child is referenced by its index. The match then walks
+ * through one contiguous block of memory instead of chasing pointers
+ * to nodes scattered in a linpool. Adding a prefix to a compiled trie
+ * drops the compiled form.
  */
 
 #include "nest/bird.h"
@@ -121,6 +129,9 @@ attach_node(struct f_trie_node *parent, struct f_trie_node *child)
 void
 trie_add_prefix(struct f_trie *t, ip_addr px, int plen, int l, int h)
 {
+  /* Compiled form is no longer valid */
+  t->flat = NULL;
+
   if (l == 0)
     t->zero = 1;
   else
@@ -189,6 +200,92 @@ trie_add_prefix(struct f_trie *t, ip_addr px, int plen, int l, int h)
   attach_node(o, a);
 }
 
+static u32
+trie_node_count(struct f_trie_node *n)
+{
+  return n ? 1 + trie_node_count(n->c[0]) + trie_node_count(n->c[1]) : 0;
+}
+
+static u32
+trie_flatten(struct f_trie_fnode *flat, u32 pos, struct f_trie_node *n)
+{
+  struct f_trie_fnode *f = &flat[pos++];
+
+  f->addr = n->addr;
+  f->mask = n->mask;
+  f->accept = n->accept;
+  f->plen = n->plen;
+  f->left = !!n->c[0];
+
+  if (n->c[0])
+    pos = trie_flatten(flat, pos, n->c[0]);
+
+  f->right = n->c[1] ? pos : 0;
+
+  if (n->c[1])
+    pos = trie_flatten(flat, pos, n->c[1]);
+
+  return pos;
+}
+
+/**
+ * trie_compile
+ * @t: trie
+ *
+ * Builds the compiled (flattened) form of the trie @t, which is then
+ * used by trie_match_prefix(). The array is allocated from the linpool
+ * of the trie. The compiled form is dropped when a prefix is added
+ * to the trie, so it should be called after the trie is complete.
+ */
+void
+trie_compile(struct f_trie *t)
+{
+  u32 count = trie_node_count(&t->root);
+  struct f_trie_fnode *flat = lp_alloc(t->lp, count * sizeof(struct f_trie_fnode));
+
+  trie_flatten(flat, 0, &t->root);
+  t->flat = flat;
+}
+
+static int
+trie_match_flat(struct f_trie *t, ip_addr paddr, ip_addr pmask, int plen)
+{
+  struct f_trie_fnode *flat = t->flat;
+  struct f_trie_fnode *n = flat;
+  int plentest = plen - 1;
+
+  while (1)
+    {
+      ip_addr cmask = ipa_and(n->mask, pmask);
+
+      /* We are out of path */
+      if (ipa_nonzero(ipa_and(ipa_xor(paddr, n->addr), cmask)))
+	return 0;
+
+      /* Check accept mask */
+      if (ipa_getbit(n->accept, plentest))
+	return 1;
+
+      /* We finished trie walk and still no match */
+      if (plen <= n->plen)
+	return 0;
+
+      /* Choose children */
+      if (ipa_getbit(paddr, n->plen))
+	{
+	  if (!n->right)
+	    return 0;
+	  n = flat + n->right;
+	}
+      else
+	{
+	  if (!n->left)
+	    return 0;
+	  n++;
+	}
+    }
+}
+
 /**
  * trie_match
  * @t: trie
@@ -208,6 +305,9 @@ trie_match_prefix(struct f_trie *t, ip_addr px, int plen)
   if (plen == 0)
     return t->zero;
 
+  if (t->flat)
+    return trie_match_flat(t, paddr, pmask, plen);
+
   int plentest = plen - 1;
   struct f_trie_node *n = &t->root;
 
@@ -55,6 +55,7 @@ void log_commit(int class);
 void log_msg(char *msg, ...);
 void log_rl(struct rate_limit *rl, char *msg, ...);
 void logn(char *msg, ...);
+void log_flush(void);
 void die(char *msg, ...) NORET;
 void bug(char *msg, ...) NORET;
 
@@ -68,6 +69,8 @@ void bug(char *msg, ...) NORET;
 #define L_FATAL "\010"			/* Fatal errors */
 #define L_BUG "\011"			/* BIRD bugs */
 
+extern unsigned log_dropped;		/* Number of log messages dropped on overload */
+
 void debug(char *msg, ...);		/* Printf to debug output */
 
 /* Debugging */
@@ -21,6 +21,7 @@
 
 #include "nest/bird.h"
 #include "lib/event.h"
+#include "lib/perf.h"
 
 event_list global_event_list;
 
@@ -81,8 +82,15 @@ ev_new(pool *p)
 inline void
 ev_run(event *e)
 {
+  void (*hook)(void *) = e->hook;
+  u64 start = perf_start();
+  u64 d;
+
   ev_postpone(e);
-  e->hook(e->data);
+  hook(e->data);
+  d = current_time_nsec() - start;
+  perf_hist_add(&perf_event_hist, d);
+  watchdog_check(WD_EVENT, hook, d);
 }
 
 /**
@@ -39,12 +39,21 @@ char *
 ip_ntop(ip_addr a, char *b)
 {
   u32 x = _I(a);
+  int i, v;
 
-  return b + bsprintf(b, "%d.%d.%d.%d",
-		      ((x >> 24) & 0xff),
-		      ((x >> 16) & 0xff),
-		      ((x >> 8) & 0xff),
-		      (x & 0xff));
+  /* Formatted by hand, this is used heavily when dumping routing tables */
+  for (i = 24; i >= 0; i -= 8)
+    {
+      v = (x >> i) & 0xff;
+      if (v >= 100)
+	*b++ = '0' + v / 100;
+      if (v >= 10)
+	*b++ = '0' + (v / 10) % 10;
+      *b++ = '0' + v % 10;
+      *b++ = i ? '.' : 0;
+    }
+
+  return b - 1;
 }
 
 char *
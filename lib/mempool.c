@@ -13,6 +13,12 @@
  * support very fast allocation of new blocks, but are able to free only
  * the whole collection at once.
  *
+ * Memory chunks are recycled: normal chunks not needed after a flush go to
+ * a global cache of free chunks shared by all linear pools and large chunks are
+ * kept for reuse by subsequent large allocations. A part of a linear pool can
+ * be freed, too -- allocations made after lp_save() are released by
+ * lp_restore(), which is useful for temporary allocations in loops.
+ *
  * Example: Each configuration is described by a complex system of structures,
  * linked lists and function trees which are all allocated from a single linear
  * pool, thus they can be freed at once when the configuration is no longer used.
@@ -37,9 +43,18 @@ struct linpool {
   byte *ptr, *end;
   struct lp_chunk *first, *current, **plast;	/* Normal (reusable) chunks */
   struct lp_chunk *first_large;			/* Large chunks */
-  unsigned chunk_size, threshold, total, total_large;
+  struct lp_chunk *free_large;			/* Large chunks for reuse */
+  unsigned chunk_size, threshold, total, total_large, total_free_large;
+  unsigned chunks, free_large_count;
 };
 
+#define LP_KEEP_CHUNKS 4	/* Normal chunks kept by a linpool after lp_flush() */
+#define LP_KEEP_LARGE 4		/* Large chunks kept by a linpool for reuse */
+#define LP_CACHE_MAX 64		/* Size of global cache of free normal chunks */
+
+static struct lp_chunk *lp_cache;	/* Global cache of free normal chunks */
+static unsigned lp_cache_count;
+
 static void lp_free(resource *);
 static void lp_dump(resource *);
 static resource *lp_lookup(resource *, unsigned long);
@@ -54,6 +69,89 @@ static struct resclass lp_class = {
   lp_memsize
 };
 
+static struct lp_chunk *
+lp_get_chunk(unsigned size)
+{
+  struct lp_chunk *c, **cp;
+
+  for (cp = &lp_cache; c = *cp; cp = &c->next)
+    if (c->size == size)
+      {
+	*cp = c->next;
+	lp_cache_count--;
+	return c;
+      }
+
+  c = xmalloc(sizeof(struct lp_chunk) + size);
+  c->size = size;
+  return c;
+}
+
+static void
+lp_put_chunk(struct lp_chunk *c)
+{
+  if (lp_cache_count >= LP_CACHE_MAX)
+    {
+      xfree(c);
+      return;
+    }
+
+  c->next = lp_cache;
+  lp_cache = c;
+  lp_cache_count++;
+}
+
+static struct lp_chunk *
+lp_get_large(linpool *m, unsigned size)
+{
+  struct lp_chunk *c, **cp;
+
+  /* Reuse a large chunk if it is not too much larger */
+  for (cp = &m->free_large; c = *cp; cp = &c->next)
+    if ((c->size >= size) && (c->size / 2 <= size))
+      {
+	*cp = c->next;
+	m->free_large_count--;
+	m->total_free_large -= c->size;
+	return c;
+      }
+
+  c = xmalloc(sizeof(struct lp_chunk) + size);
+  c->size = size;
+  return c;
+}
+
+/* Release large chunks allocated after @stop */
+static void
+lp_release_large(linpool *m, struct lp_chunk *stop)
+{
+  struct lp_chunk *c;
+
+  while ((c = m->first_large) != stop)
+    {
+      m->first_large = c->next;
+      m->total_large -= c->size;
+
+      if (m->free_large_count >= LP_KEEP_LARGE)
+	{
+	  /* Drop the oldest kept chunk */
+	  struct lp_chunk *d, **dp = &m->free_large;
+	  while ((*dp)->next)
+	    dp = &(*dp)->next;
+	  d = *dp;
+	  *dp = NULL;
+	  m->free_large_count--;
+	  m->total_free_large -= d->size;
+	  xfree(d);
+	}
+
+      c->next = m->free_large;
+      m->free_large = c;
+      m->free_large_count++;
+      m->total_free_large += c->size;
+    }
+}
+
 /**
  * lp_new - create a new linear memory pool
  * @p: pool
@@ -104,11 +202,10 @@ lp_alloc(linpool *m, unsigned size)
       if (size >= m->threshold)
 	{
 	  /* Too large => allocate large chunk */
-	  c = xmalloc(sizeof(struct lp_chunk) + size);
-	  m->total_large += size;
+	  c = lp_get_large(m, size);
+	  m->total_large += c->size;
 	  c->next = m->first_large;
 	  m->first_large = c;
-	  c->size = size;
 	}
       else
 	{
@@ -120,13 +217,13 @@ lp_alloc(linpool *m, unsigned size)
 	    }
 	  else
 	    {
-	      /* Need to allocate a new chunk */
-	      c = xmalloc(sizeof(struct lp_chunk) + m->chunk_size);
+	      /* Need to get a new chunk */
+	      c = lp_get_chunk(m->chunk_size);
 	      m->total += m->chunk_size;
+	      m->chunks++;
 	      *m->plast = c;
 	      m->plast = &c->next;
 	      c->next = NULL;
-	      c->size = m->chunk_size;
 	    }
 	  m->ptr = c->data + size;
 	  m->end = c->data + m->chunk_size;
@@ -181,22 +278,71 @@ lp_allocz(linpool *m, unsigned size)
  * @m: linear memory pool
  *
  * This function frees the whole contents of the given &linpool @m,
- * but leaves the pool itself.
+ * but leaves the pool itself. A few chunks are kept for subsequent
+ * allocations, the other ones are returned to the global cache.
  */
 void
 lp_flush(linpool *m)
 {
-  struct lp_chunk *c;
+  struct lp_chunk *c, **cp;
+  unsigned i;
 
-  /* Relink all normal chunks to free list and free all large chunks */
+  /* Relink normal chunks to free list, keeping just a few of them */
   m->ptr = m->end = NULL;
-  m->current = m->first;
-  while (c = m->first_large)
+  if (m->chunks > LP_KEEP_CHUNKS)
     {
-      m->first_large = c->next;
-      xfree(c);
+      for (cp = &m->first, i = 0; i < LP_KEEP_CHUNKS; i++)
+	cp = &(*cp)->next;
+      while (c = *cp)
+	{
+	  *cp = c->next;
+	  lp_put_chunk(c);
+	}
+      m->plast = cp;
+      m->chunks = LP_KEEP_CHUNKS;
+      m->total = LP_KEEP_CHUNKS * m->chunk_size;
     }
-  m->total_large = 0;
+  m->current = m->first;
+
+  /* Large chunks are kept for reuse */
+  lp_release_large(m, NULL);
+}
+
+/**
+ * lp_save - save the state of a linear memory pool
+ * @m: linear memory pool
+ * @p: state buffer
+ *
+ * This function saves the state of the given &linpool @m to the
+ * state buffer @p. The state can be later restored by lp_restore().
+ */
+void
+lp_save(linpool *m, lp_state *p)
+{
+  p->current = m->current;
+  p->plast = m->plast;
+  p->large = m->first_large;
+  p->ptr = m->ptr;
+  p->end = m->end;
+}
+
+/**
+ * lp_restore - restore the state of a linear memory pool
+ * @m: linear memory pool
+ * @p: saved state
+ *
+ * This function frees all memory allocated from the &linpool @m
+ * since the state @p was saved by lp_save(), keeping the older
+ * allocations. The state is invalidated by lp_flush().
+ */
+void
+lp_restore(linpool *m, lp_state *p)
+{
+  /* Chunks appended after the save follow the saved last chunk */
+  m->current = p->current ? p->current : *(struct lp_chunk **) p->plast;
+  m->ptr = p->ptr;
+  m->end = p->end;
+  lp_release_large(m, p->large);
 }
 
 static void
@@ -208,13 +354,18 @@ lp_free(resource *r)
   for(d=m->first; d; d = c)
     {
       c = d->next;
-      xfree(d);
+      lp_put_chunk(d);
     }
   for(d=m->first_large; d; d = c)
     {
       c = d->next;
       xfree(d);
     }
+  for(d=m->free_large; d; d = c)
+    {
+      c = d->next;
+      xfree(d);
+    }
 }
 
 static void
@@ -228,13 +379,15 @@ lp_dump(resource *r)
     ;
   for(cntl=0, c=m->first_large; c; c=c->next, cntl++)
     ;
-  debug("(chunk=%d threshold=%d count=%d+%d total=%d+%d)\n",
+  debug("(chunk=%d threshold=%d count=%d+%d+%d total=%d+%d+%d)\n",
 	m->chunk_size,
 	m->threshold,
 	cnt,
 	cntl,
+	m->free_large_count,
 	m->total,
-	m->total_large);
+	m->total_large,
+	m->total_free_large);
 }
 
 static size_t
@@ -248,10 +401,11 @@ lp_memsize(resource *r)
     cnt++;
   for(c=m->first_large; c; c=c->next)
     cnt++;
+  cnt += m->free_large_count;
 
   return ALLOC_OVERHEAD + sizeof(struct linpool) +
     cnt * (ALLOC_OVERHEAD + sizeof(sizeof(struct lp_chunk))) +
-    m->total + m->total_large;
+    m->total + m->total_large + m->total_free_large;
 }
 
 
@@ -0,0 +1,83 @@
+/*
+ *	BIRD Library -- Performance Counters
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+/**
+ * DOC: Performance counters
+ *
+ * Performance counters record how many times selected expensive
+ * operations (filter runs, table pruning, SPF calculation, ...) were
+ * performed and how much time they took. Callers surround the
+ * operation by perf_start() and perf_end(). Durations of event and
+ * timer hooks are collected to histograms with decimal buckets
+ * (from below 10us to over 1s). Time is measured by the monotonic
+ * clock with nanosecond resolution, which is cheap enough to stay
+ * enabled all the time. The counters are shown by the |show perf|
+ * command and cleared by |reset perf|.
+ *
+ * The main loop also passes every event, timer and socket hook running
+ * longer than %WATCHDOG_MIN to watchdog_record(), which keeps the
+ * slowest hooks in a small table (shown by |show watchdog|) and logs
+ * a warning when a hook exceeds the configured |watchdog warning| limit.
+ */
+
+#include "nest/bird.h"
+#include "lib/perf.h"
+#include "lib/string.h"
+
+struct perf_counter perf_counters[PERF_MAX];
+struct perf_hist perf_event_hist, perf_timer_hist;
+bird_clock_t perf_reset_time;
+struct watchdog_entry watchdog_top[WATCHDOG_SLOTS];
+
+char *watchdog_kind_names[] = {
+  [WD_EVENT] = "event",
+  [WD_TIMER] = "timer",
+  [WD_RX] = "rx",
+  [WD_TX] = "tx",
+};
+
+char *perf_counter_names[PERF_MAX] = {
+  [PERF_LOOP] = "Main loop",
+  [PERF_POLL] = "Poll wait",
+  [PERF_FILTER] = "Filters",
+  [PERF_PRUNE] = "Table prune",
+  [PERF_KRT_PRUNE] = "Kernel prune",
+  [PERF_SPF] = "OSPF SPF",
+  [PERF_PXASSIGN] = "OSPF pxassign",
+};
+
+/**
+ * perf_hist_add - add a duration to a histogram
+ * @h: histogram
+ * @d: duration in ns
+ */
+void
+perf_hist_add(struct perf_hist *h, u64 d)
+{
+  u64 lim = 10000;
+  unsigned i;
+
+  for (i = 0; (i < PERF_HIST_SIZE - 1) && (d >= lim); i++)
+    lim *= 10;
+
+  h->count[i]++;
+  h->time += d;
+}
+
+/**
+ * perf_reset - clear all performance counters
+ *
+ * The table of slow hooks kept by the watchdog is cleared too.
+ */
+void
+perf_reset(void)
+{
+  bzero(perf_counters, sizeof(perf_counters));
+  bzero(&perf_event_hist, sizeof(perf_event_hist));
+  bzero(&perf_timer_hist, sizeof(perf_timer_hist));
+  bzero(watchdog_top, sizeof(watchdog_top));
+  perf_reset_time = now;
+}
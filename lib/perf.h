@@ -0,0 +1,94 @@
+/*
+ *	BIRD Library -- Performance Counters
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+#ifndef _BIRD_PERF_H_
+#define _BIRD_PERF_H_
+
+#include "lib/timer.h"
+
+enum perf_counter_id {
+  PERF_LOOP,				/* Main loop work between two polls */
+  PERF_POLL,				/* Main loop waiting for sockets */
+  PERF_FILTER,				/* Filter runs (f_run()) */
+  PERF_PRUNE,				/* Routing table pruning (rt_prune_loop()) */
+  PERF_KRT_PRUNE,			/* Kernel table sync (krt_prune()) */
+  PERF_SPF,				/* OSPF routing table calculation (ospf_rt_spf()) */
+  PERF_PXASSIGN,			/* OSPF prefix assignment (ospf_pxassign()) */
+  PERF_MAX
+};
+
+struct perf_counter {
+  u64 calls;
+  u64 time;				/* Total time in ns */
+  u64 max;				/* The longest call in ns */
+};
+
+#define PERF_HIST_SIZE 7		/* <10us, <100us, <1ms, <10ms, <100ms, <1s, more */
+
+struct perf_hist {
+  u32 count[PERF_HIST_SIZE];
+  u64 time;				/* Total time in ns */
+};
+
+extern struct perf_counter perf_counters[PERF_MAX];
+extern struct perf_hist perf_event_hist, perf_timer_hist;
+extern char *perf_counter_names[PERF_MAX];
+extern bird_clock_t perf_reset_time;
+
+static inline u64 perf_start(void)
+{ return current_time_nsec(); }
+
+static inline void
+perf_end(unsigned id, u64 start)
+{
+  struct perf_counter *c = &perf_counters[id];
+  u64 d = current_time_nsec() - start;
+
+  c->calls++;
+  c->time += d;
+  if (d > c->max)
+    c->max = d;
+}
+
+void perf_hist_add(struct perf_hist *h, u64 d);
+
+static inline void perf_hist_end(struct perf_hist *h, u64 start)
+{ perf_hist_add(h, current_time_nsec() - start); }
+
+void perf_reset(void);
+
+/* Slow hook watchdog (sysdep) */
+
+enum watchdog_kind {
+  WD_EVENT,
+  WD_TIMER,
+  WD_RX,				/* Socket rx_hook */
+  WD_TX,				/* Socket tx_hook */
+};
+
+#define WATCHDOG_MIN		1000000	/* Hooks shorter than 1 ms are not recorded */
+#define WATCHDOG_SLOTS		16
+#define WATCHDOG_NAME_SIZE	128
+
+struct watchdog_entry {
+  void *hook;				/* NULL for an unused slot */
+  unsigned kind;
+  u32 count;				/* Number of runs longer than WATCHDOG_MIN */
+  u64 time;				/* Total time of these runs in ns */
+  u64 max;				/* The longest run in ns */
+  bird_clock_t last;			/* When the longest run happened */
+  char name[WATCHDOG_NAME_SIZE];
+};
+
+extern struct watchdog_entry watchdog_top[WATCHDOG_SLOTS];
+extern char *watchdog_kind_names[];
+
+void watchdog_record(unsigned kind, void *hook, u64 d, char *desc);
+
+static inline void watchdog_check(unsigned kind, void *hook, u64 d)
+{ if (d >= WATCHDOG_MIN) watchdog_record(kind, hook, d, NULL); }
+
+#endif
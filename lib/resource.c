@@ -28,10 +28,19 @@
  * is freed upon shutdown of the module.
  */
 
+#define MB_CLASSES 14
+#define MB_MAX_CLASS 512		/* Larger blocks are allocated separately */
+#define MB_SLAB_MIN 16			/* Number of blocks of a class allocated before its slab is created */
+
+static const unsigned mb_class_size[MB_CLASSES] =
+  { 16, 32, 48, 64, 80, 96, 128, 160, 192, 256, 320, 384, 448, 512 };
+
 struct pool {
   resource r;
   list inside;
   char *name;
+  slab *mb_slab[MB_CLASSES];		/* Slabs for small memory blocks, see mb_alloc() */
+  unsigned mb_count[MB_CLASSES];	/* Number of small blocks allocated before the slab */
 };
 
 static void pool_dump(resource *);
@@ -273,15 +282,27 @@ resource_init(void)
  *
  * Example: All "unique" data structures such as hash tables are allocated
  * as memory blocks.
+ *
+ * Small memory blocks are allocated from per-pool slabs of a few size
+ * classes, so they are neither linked to the list of resources of the pool
+ * nor allocated by malloc() separately. The slab of a class is created when
+ * the pool has allocated several blocks of that class, so pools with just a
+ * few blocks do not waste whole slab pages. Large blocks and blocks allocated
+ * before the slab exists are separate resources.
  */
 
-struct mblock {
-  resource r;
+struct mbhead {
+  slab *slab;				/* Slab of a small block, NULL for a separate one */
   unsigned size;
   uintptr_t data_align[0];
   byte data[0];
 };
 
+struct mblock {
+  resource r;
+  struct mbhead h;
+};
+
 static void mbl_free(resource *r UNUSED)
 {
 }
@@ -290,7 +311,7 @@ static void mbl_debug(resource *r)
 {
   struct mblock *m = (struct mblock *) r;
 
-  debug("(size=%d)\n", m->size);
+  debug("(size=%d)\n", m->h.size);
 }
 
 static resource *
@@ -298,7 +319,7 @@ mbl_lookup(resource *r, unsigned long a)
 {
   struct mblock *m = (struct mblock *) r;
 
-  if ((unsigned long) m->data <= a && (unsigned long) m->data + m->size > a)
+  if ((unsigned long) m->h.data <= a && (unsigned long) m->h.data + m->h.size > a)
     return r;
   return NULL;
 }
@@ -307,7 +328,7 @@ static size_t
 mbl_memsize(resource *r)
 {
   struct mblock *m = (struct mblock *) r;
-  return ALLOC_OVERHEAD + sizeof(struct mblock) + m->size;
+  return ALLOC_OVERHEAD + sizeof(struct mblock) + m->h.size;
 }
 
 static struct resclass mb_class = {
@@ -319,6 +340,16 @@ static struct resclass mb_class = {
   mbl_memsize
 };
 
+static inline int
+mb_size_class(unsigned size)
+{
+  int c = 0;
+
+  while (mb_class_size[c] < size)
+    c++;
+  return c;
+}
+
 /**
  * mb_alloc - allocate a memory block
  * @p: pool
@@ -335,12 +366,30 @@ static struct resclass mb_class = {
 void *
 mb_alloc(pool *p, unsigned size)
 {
-  struct mblock *b = xmalloc(sizeof(struct mblock) + size);
+  struct mblock *b;
+
+  if (size <= MB_MAX_CLASS)
+    {
+      int c = mb_size_class(size);
+
+      if (!p->mb_slab[c] && (++p->mb_count[c] > MB_SLAB_MIN))
+	p->mb_slab[c] = sl_new(p, sizeof(struct mbhead) + mb_class_size[c]);
+
+      if (p->mb_slab[c])
+	{
+	  struct mbhead *h = sl_alloc(p->mb_slab[c]);
+	  h->slab = p->mb_slab[c];
+	  h->size = size;
+	  return h->data;
+	}
+    }
 
+  b = xmalloc(sizeof(struct mblock) + size);
   b->r.class = &mb_class;
   add_tail(&p->inside, &b->r.n);
-  b->size = size;
-  return b->data;
+  b->h.slab = NULL;
+  b->h.size = size;
+  return b->h.data;
 }
 
 /**
@@ -382,21 +431,39 @@ mb_allocz(pool *p, unsigned size)
 void *
 mb_realloc(pool *p, void *m, unsigned size)
 {
-  struct mblock *ob = NULL;
+  struct mbhead *h;
+  struct mblock *b;
+  void *n;
+
+  if (!m)
+    return mb_alloc(p, size);
 
-  if (m)
+  h = SKIP_BACK(struct mbhead, data, m);
+  if (h->slab)
     {
-      ob = SKIP_BACK(struct mblock, data, m);
-      if (ob->r.n.next)
-	rem_node(&ob->r.n);
+      /* Small block of the same class can be kept */
+      if ((size <= MB_MAX_CLASS) && (h->slab == p->mb_slab[mb_size_class(size)]))
+	{
+	  h->size = size;
+	  return m;
+	}
+    }
+  else if (size > MB_MAX_CLASS)
+    {
+      b = SKIP_BACK(struct mblock, h, h);
+      if (b->r.n.next)
+	rem_node(&b->r.n);
+
+      b = xrealloc(b, sizeof(struct mblock) + size);
+      add_tail(&p->inside, &b->r.n);
+      b->h.size = size;
+      return b->h.data;
     }
 
-  struct mblock *b = xrealloc(ob, sizeof(struct mblock) + size);
-
-  b->r.class = &mb_class;
-  add_tail(&p->inside, &b->r.n);
-  b->size = size;
-  return b->data;
+  n = mb_alloc(p, size);
+  memcpy(n, m, MIN(size, h->size));
+  mb_free(m);
+  return n;
 }
 
 
@@ -409,7 +476,11 @@ mb_realloc(pool *p, void *m, unsigned size)
 void
 mb_free(void *m)
 {
-  struct mblock *b = SKIP_BACK(struct mblock, data, m);
-  rfree(b);
+  struct mbhead *h = SKIP_BACK(struct mbhead, data, m);
+
+  if (h->slab)
+    sl_free(h->slab, h);
+  else
+    rfree(SKIP_BACK(struct mblock, h, h));
 }
 
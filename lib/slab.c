@@ -22,11 +22,20 @@
  * newly allocated and freed blocks with a special pattern to make detection
  * of use of uninitialized or already freed memory easier.
  *
+ * Slab pages are aligned to their size, which is chosen according to the
+ * size of objects, so the objects need no back-pointers to their pages.
+ * Recently freed objects are cached in a small per-slab magazine and reused
+ * first, which makes alloc/free cycles cheap. Slab pages are carved from
+ * large regions shared by all slabs. If the |SLAB_HUGE_PAGES| switch is
+ * turned on, the regions are backed by huge pages to reduce TLB pressure
+ * of slabs with millions of objects.
+ *
  * Example: Nodes of a FIB are allocated from a per-FIB Slab.
  */
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <sys/mman.h>
 
 #include "nest/bird.h"
 #include "lib/resource.h"
@@ -139,13 +148,23 @@ slab_memsize(resource *r)
  *  Real efficient version.
  */
 
-#define SLAB_SIZE 4096
+#define SLAB_PAGE_SIZE 4096		/* Minimal size of slab page */
+#define SLAB_MAX_ORDER 4		/* Maximal slab page is SLAB_PAGE_SIZE << SLAB_MAX_ORDER */
+#define SLAB_MIN_OBJS 32		/* Use larger pages until they hold this number of objects */
+#define SLAB_MAG_SIZE 32		/* Size of magazine of recently freed objects */
+#define SLAB_COLOR_SIZE 64		/* Cache line size for coloring of heads */
+#define SLAB_COLOR_SPACE (7 * SLAB_COLOR_SIZE)	/* Reserved for coloring, at least 8 colors */
 #define MAX_EMPTY_HEADS 1
 
+#define SLAB_REGION_SIZE (2 << 20)	/* Slab pages are allocated from regions of this size */
+#undef SLAB_HUGE_PAGES	/* Turn on if you want regions to be backed by huge pages */
+
 struct slab {
   resource r;
   unsigned obj_size, head_size, objs_per_slab, num_empty_heads, data_size;
+  unsigned page_order, page_size, head_offset, color_mask, mag_count;
   list empty_heads, partial_heads, full_heads;
+  void *mag[SLAB_MAG_SIZE];		/* Magazine of recently freed objects */
 };
 
 static struct resclass sl_class = {
@@ -157,6 +176,13 @@ static struct resclass sl_class = {
   slab_memsize
 };
 
+/*
+ * Slab pages are aligned to their size, so the head of the page an object
+ * belongs to is found just by masking the address of the object. Heads are
+ * placed after the objects, shifted by a color derived from the page address
+ * within the unused space at the end of the page, so that heads of different
+ * pages do not compete for the same cache sets.
+ */
 struct sl_head {
   node n;
   struct sl_obj *first_free;
@@ -164,11 +190,7 @@ struct sl_head {
 };
 
 struct sl_obj {
-  struct sl_head *slab;
-  union {
-    struct sl_obj *next;
-    byte data[0];
-  } u;
+  struct sl_obj *next;
 };
 
 struct sl_alignment {			/* Magic structure for testing of alignment */
@@ -176,43 +198,139 @@ struct sl_alignment {			/* Magic structure for testing of alignment */
   int x[0];
 };
 
+/*
+ * Slab pages are carved from regions of SLAB_REGION_SIZE bytes which are
+ * never returned to the system. Freed pages are kept in free lists for reuse
+ * by slabs with the same page size.
+ */
+
+static void *sl_free_pages[SLAB_MAX_ORDER+1];
+static byte *sl_region_pos, *sl_region_end;
+
+static void
+sl_new_region(void)
+{
+  /* Over-allocate to be able to align the region */
+  byte *r = mmap(NULL, 2 * SLAB_REGION_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (r == MAP_FAILED)
+    die("Unable to allocate %d bytes of memory", 2 * SLAB_REGION_SIZE);
+
+  sl_region_pos = (byte *) (((uintptr_t) r + SLAB_REGION_SIZE - 1) & ~((uintptr_t) SLAB_REGION_SIZE - 1));
+  sl_region_end = sl_region_pos + SLAB_REGION_SIZE;
+  if (sl_region_pos > r)
+    munmap(r, sl_region_pos - r);
+  if (sl_region_end < r + 2 * SLAB_REGION_SIZE)
+    munmap(sl_region_end, r + 2 * SLAB_REGION_SIZE - sl_region_end);
+#if defined(SLAB_HUGE_PAGES) && defined(MADV_HUGEPAGE)
+  madvise(sl_region_pos, SLAB_REGION_SIZE, MADV_HUGEPAGE);
+#endif
+}
+
+static void *
+sl_page_alloc(unsigned order)
+{
+  unsigned size = SLAB_PAGE_SIZE << order;
+  void *pg = sl_free_pages[order];
+
+  if (pg)
+    {
+      sl_free_pages[order] = * (void **) pg;
+      return pg;
+    }
+
+  for (;;)
+    {
+      if (sl_region_pos == sl_region_end)
+	sl_new_region();
+
+      if (!((uintptr_t) sl_region_pos & (size - 1)))
+	break;
+
+      /* Put the unaligned space before the next page to free lists */
+      unsigned o = 0;
+      while ((o+1 < order) && !((uintptr_t) sl_region_pos & ((SLAB_PAGE_SIZE << (o+1)) - 1)))
+	o++;
+      * (void **) sl_region_pos = sl_free_pages[o];
+      sl_free_pages[o] = sl_region_pos;
+      sl_region_pos += SLAB_PAGE_SIZE << o;
+    }
+
+  pg = sl_region_pos;
+  sl_region_pos += size;
+  return pg;
+}
+
+static void
+sl_page_free(void *pg, unsigned order)
+{
+  * (void **) pg = sl_free_pages[order];
+  sl_free_pages[order] = pg;
+}
+
 /**
  * sl_new - create a new Slab
  * @p: resource pool
  * @size: block size
  *
  * This function creates a new Slab resource from which
- * objects of size @size can be allocated.
+ * objects of size @size can be allocated. The size of slab
+ * pages is chosen according to @size, so that each page
+ * holds a reasonable number of objects.
  */
 slab *
 sl_new(pool *p, unsigned size)
 {
   slab *s = ralloc(p, &sl_class);
   unsigned int align = sizeof(struct sl_alignment);
+  unsigned int colors;
   if (align < sizeof(int))
     align = sizeof(int);
   s->data_size = size;
-  size += OFFSETOF(struct sl_obj, u.data);
   if (size < sizeof(struct sl_obj))
     size = sizeof(struct sl_obj);
   size = (size + align - 1) / align * align;
   s->obj_size = size;
   s->head_size = (sizeof(struct sl_head) + align - 1) / align * align;
-  s->objs_per_slab = (SLAB_SIZE - s->head_size) / size;
+  s->page_order = 0;
+  while ((s->page_order < SLAB_MAX_ORDER) &&
+	 ((SLAB_PAGE_SIZE << s->page_order) - s->head_size - SLAB_COLOR_SPACE) / size < SLAB_MIN_OBJS)
+    s->page_order++;
+  s->page_size = SLAB_PAGE_SIZE << s->page_order;
+  s->objs_per_slab = (s->page_size - s->head_size - SLAB_COLOR_SPACE) / size;
   if (!s->objs_per_slab)
     bug("Slab: object too large");
+  s->head_offset = s->objs_per_slab * size;
+  colors = (s->page_size - s->head_offset - s->head_size) / SLAB_COLOR_SIZE + 1;
+  for (s->color_mask = 1; 2 * s->color_mask <= colors; s->color_mask *= 2)
+    ;
+  s->color_mask--;
   s->num_empty_heads = 0;
+  s->mag_count = 0;
   init_list(&s->empty_heads);
   init_list(&s->partial_heads);
   init_list(&s->full_heads);
   return s;
 }
 
+static inline struct sl_head *
+sl_head_of(slab *s, void *o)
+{
+  uintptr_t pg = (uintptr_t) o & ~((uintptr_t) s->page_size - 1);
+  unsigned color = (pg / s->page_size) & s->color_mask;
+  return (struct sl_head *) (pg + s->head_offset + color * SLAB_COLOR_SIZE);
+}
+
+static inline void *
+sl_page_of(slab *s, struct sl_head *h)
+{
+  return (void *) ((uintptr_t) h & ~((uintptr_t) s->page_size - 1));
+}
+
 static struct sl_head *
 sl_new_head(slab *s)
 {
-  struct sl_head *h = xmalloc(SLAB_SIZE);
-  struct sl_obj *o = (struct sl_obj *)((byte *)h+s->head_size);
+  struct sl_obj *o = sl_page_alloc(s->page_order);
+  struct sl_head *h = sl_head_of(s, o);
   struct sl_obj *no;
   unsigned int n = s->objs_per_slab;
 
@@ -220,9 +338,8 @@ sl_new_head(slab *s)
   h->num_full = 0;
   while (n--)
     {
-      o->slab = h;
       no = (struct sl_obj *)((char *) o+s->obj_size);
-      o->u.next = n ? no : NULL;
+      o->next = n ? no : NULL;
       o = no;
     }
   return h;
@@ -233,7 +350,8 @@ sl_new_head(slab *s)
  * @s: slab
  *
  * sl_alloc() allocates space for a single object from the
- * Slab and returns a pointer to the object.
+ * Slab and returns a pointer to the object. Recently freed
+ * objects are reused first.
  */
 void *
 sl_alloc(slab *s)
@@ -241,6 +359,12 @@ sl_alloc(slab *s)
   struct sl_head *h;
   struct sl_obj *o;
 
+  if (s->mag_count)
+    {
+      o = s->mag[--s->mag_count];
+      goto done;
+    }
+
 redo:
   h = HEAD(s->partial_heads);
   if (!h->n.next)
@@ -249,12 +373,13 @@ okay:
   o = h->first_free;
   if (!o)
     goto full_partial;
-  h->first_free = o->u.next;
+  h->first_free = o->next;
   h->num_full++;
+done:
 #ifdef POISON
-  memset(o->u.data, 0xcd, s->data_size);
+  memset(o, 0xcd, s->data_size);
 #endif
-  return o->u.data;
+  return o;
 
 full_partial:
   rem_node(&h->n);
@@ -275,43 +400,53 @@ no_partial:
   goto okay;
 }
 
-/**
- * sl_free - return a free object back to a Slab
- * @s: slab
- * @oo: object returned by sl_alloc()
- *
- * This function frees memory associated with the object @oo
- * and returns it back to the Slab @s.
- */
-void
-sl_free(slab *s, void *oo)
+static void
+sl_release(slab *s, struct sl_obj *o)
 {
-  struct sl_obj *o = SKIP_BACK(struct sl_obj, u.data, oo);
-  struct sl_head *h = o->slab;
+  struct sl_head *h = sl_head_of(s, o);
 
-#ifdef POISON
-  memset(oo, 0xdb, s->data_size);
-#endif
-  o->u.next = h->first_free;
+  o->next = h->first_free;
   h->first_free = o;
   if (!--h->num_full)
     {
       rem_node(&h->n);
       if (s->num_empty_heads >= MAX_EMPTY_HEADS)
-	xfree(h);
+	sl_page_free(sl_page_of(s, h), s->page_order);
       else
 	{
 	  add_head(&s->empty_heads, &h->n);
 	  s->num_empty_heads++;
 	}
     }
-  else if (!o->u.next)
+  else if (!o->next)
     {
       rem_node(&h->n);
       add_head(&s->partial_heads, &h->n);
     }
 }
 
+/**
+ * sl_free - return a free object back to a Slab
+ * @s: slab
+ * @oo: object returned by sl_alloc()
+ *
+ * This function frees memory associated with the object @oo
+ * and returns it back to the Slab @s. The object is kept in
+ * the magazine of the Slab for a quick reuse unless the magazine
+ * is full.
+ */
+void
+sl_free(slab *s, void *oo)
+{
+#ifdef POISON
+  memset(oo, 0xdb, s->data_size);
+#endif
+  if (s->mag_count < SLAB_MAG_SIZE)
+    s->mag[s->mag_count++] = oo;
+  else
+    sl_release(s, oo);
+}
+
 static void
 slab_free(resource *r)
 {
@@ -319,11 +454,11 @@ slab_free(resource *r)
   struct sl_head *h, *g;
 
   WALK_LIST_DELSAFE(h, g, s->empty_heads)
-    xfree(h);
+    sl_page_free(sl_page_of(s, h), s->page_order);
   WALK_LIST_DELSAFE(h, g, s->partial_heads)
-    xfree(h);
+    sl_page_free(sl_page_of(s, h), s->page_order);
   WALK_LIST_DELSAFE(h, g, s->full_heads)
-    xfree(h);
+    sl_page_free(sl_page_of(s, h), s->page_order);
 }
 
 static void
@@ -339,7 +474,8 @@ slab_dump(resource *r)
     pc++;
   WALK_LIST(h, s->full_heads)
     fc++;
-  debug("(%de+%dp+%df blocks per %d objs per %d bytes)\n", ec, pc, fc, s->objs_per_slab, s->obj_size);
+  debug("(%de+%dp+%df blocks of %d bytes per %d objs per %d bytes, %d in magazine)\n",
+	ec, pc, fc, s->page_size, s->objs_per_slab, s->obj_size, s->mag_count);
 }
 
 static size_t
@@ -356,7 +492,7 @@ slab_memsize(resource *r)
   WALK_LIST(h, s->full_heads)
     heads++;
 
-  return ALLOC_OVERHEAD + sizeof(struct slab) + heads * (ALLOC_OVERHEAD + SLAB_SIZE);
+  return ALLOC_OVERHEAD + sizeof(struct slab) + heads * s->page_size;
 }
 
 static resource *
@@ -366,10 +502,10 @@ slab_lookup(resource *r, unsigned long a)
   struct sl_head *h;
 
   WALK_LIST(h, s->partial_heads)
-    if ((unsigned long) h < a && (unsigned long) h + SLAB_SIZE < a)
+    if ((unsigned long) sl_page_of(s, h) <= a && (unsigned long) sl_page_of(s, h) + s->page_size > a)
       return r;
   WALK_LIST(h, s->full_heads)
-    if ((unsigned long) h < a && (unsigned long) h + SLAB_SIZE < a)
+    if ((unsigned long) sl_page_of(s, h) <= a && (unsigned long) sl_page_of(s, h) + s->page_size > a)
       return r;
   return NULL;
 }
@@ -11,6 +11,7 @@
 #include "nest/route.h"
 #include "nest/attrs.h"
 #include "lib/resource.h"
+#include "lib/alloca.h"
 #include "lib/unaligned.h"
 #include "lib/string.h"
 #include "filter/filter.h"
@@ -22,8 +23,12 @@
 #define get_as get_u32
 #define BS  4
 
+/*
+ * The resulting path is shared (see adata_intern()), so prepending
+ * the same AS to the same path does not allocate any memory.
+ */
 struct adata *
-as_path_prepend(struct linpool *pool, struct adata *olda, u32 as)
+as_path_prepend(struct adata *olda, u32 as)
 {
   struct adata *newa;
 
@@ -31,7 +36,7 @@ as_path_prepend(struct linpool *pool, struct adata *olda, u32 as)
     /* Starting with sequence => just prepend the AS number */
     {
       int nl = olda->length + BS;
-      newa = lp_alloc(pool, sizeof(struct adata) + nl);
+      newa = alloca(sizeof(struct adata) + nl);
       newa->length = nl;
       newa->data[0] = AS_PATH_SEQUENCE;
       newa->data[1] = olda->data[1] + 1;
@@ -40,14 +45,14 @@ as_path_prepend(struct linpool *pool, struct adata *olda, u32 as)
   else /* Create new path segment */
     {
       int nl = olda->length + BS + 2;
-      newa = lp_alloc(pool, sizeof(struct adata) + nl);
+      newa = alloca(sizeof(struct adata) + nl);
       newa->length = nl;
       newa->data[0] = AS_PATH_SEQUENCE;
       newa->data[1] = 1;
       memcpy(newa->data + BS + 2, olda->data, olda->length);
     }
   put_as(newa->data + 2, as);
-  return newa;
+  return adata_intern(newa);
 }
 
 int
@@ -11,6 +11,7 @@
 #include "nest/route.h"
 #include "nest/attrs.h"
 #include "lib/resource.h"
+#include "lib/alloca.h"
 #include "lib/string.h"
 
 /**
@@ -177,8 +178,12 @@ ec_set_contains(struct adata *list, u64 val)
   return 0;
 }
 
+/*
+ * Unless @val is already in @list, int_set_add() and ec_set_add() return
+ * shared data (see adata_intern()).
+ */
 struct adata *
-int_set_add(struct linpool *pool, struct adata *list, u32 val)
+int_set_add(struct adata *list, u32 val)
 {
   struct adata *res;
   int len;
@@ -187,22 +192,22 @@ int_set_add(struct linpool *pool, struct adata *list, u32 val)
     return list;
 
   len = list ? list->length : 0;
-  res = lp_alloc(pool, sizeof(struct adata) + len + 4);
+  res = alloca(sizeof(struct adata) + len + 4);
   res->length = len + 4;
   * (u32 *) res->data = val;
   if (list)
     memcpy((char *) res->data + 4, list->data, list->length);
-  return res;
+  return adata_intern(res);
 }
 
 struct adata *
-ec_set_add(struct linpool *pool, struct adata *list, u64 val)
+ec_set_add(struct adata *list, u64 val)
 {
   if (ec_set_contains(list, val))
     return list;
 
   int olen = list ? list->length : 0;
-  struct adata *res = lp_alloc(pool, sizeof(struct adata) + olen + 8);
+  struct adata *res = alloca(sizeof(struct adata) + olen + 8);
   res->length = olen + 8;
 
   if (list)
@@ -212,7 +217,7 @@ ec_set_add(struct linpool *pool, struct adata *list, u64 val)
   l[0] = ec_hi(val);
   l[1] = ec_lo(val);
 
-  return res;
+  return adata_intern(res);
 }
 
 
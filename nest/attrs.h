@@ -25,7 +25,7 @@
  * to 16bit slot (like in 16bit AS_PATH). See RFC 4893 for details
  */
 
-struct adata *as_path_prepend(struct linpool *pool, struct adata *olda, u32 as);
+struct adata *as_path_prepend(struct adata *olda, u32 as);
 int as_path_convert_to_old(struct adata *path, byte *dst, int *new_used);
 int as_path_convert_to_new(struct adata *path, byte *dst, int req_as);
 void as_path_format(struct adata *path, byte *buf, unsigned int size);
@@ -92,8 +92,8 @@ int ec_format(byte *buf, u64 ec);
 int ec_set_format(struct adata *set, int from, byte *buf, unsigned int size);
 int int_set_contains(struct adata *list, u32 val);
 int ec_set_contains(struct adata *list, u64 val);
-struct adata *int_set_add(struct linpool *pool, struct adata *list, u32 val);
-struct adata *ec_set_add(struct linpool *pool, struct adata *list, u64 val);
+struct adata *int_set_add(struct adata *list, u32 val);
+struct adata *ec_set_add(struct adata *list, u64 val);
 struct adata *int_set_del(struct linpool *pool, struct adata *list, u32 val);
 struct adata *ec_set_del(struct linpool *pool, struct adata *list, u64 val);
 struct adata *int_set_union(struct linpool *pool, struct adata *l1, struct adata *l2);
@@ -148,6 +148,55 @@ cli_printf(cli *c, int code, char *msg, ...)
   memcpy(cli_alloc_out(c, size), buf, size);
 }
 
+/**
+ * cli_line_start - start a reply line written directly to the output buffer
+ * @c: CLI connection
+ * @code: numeric code of the reply, negative for continuation lines
+ * @max: maximum length of the line text, at most %CLI_MAX_LINE_TEXT
+ *
+ * This function is a low-level alternative to cli_printf() for
+ * commands producing large amounts of output. It writes the reply line
+ * prefix and returns a pointer where the caller may write up to @max
+ * bytes of the line text. The line must be finished by cli_line_end()
+ * before any other output is sent to the connection.
+ */
+byte *
+cli_line_start(cli *c, int code, int max)
+{
+  byte *buf = cli_alloc_out(c, max + 6);
+  int cd = (code < 0) ? -code : code;
+
+  ASSERT(max <= CLI_MAX_LINE_TEXT);
+  if ((code < 0) && (cd == c->last_reply))
+    *buf++ = ' ';
+  else
+    {
+      buf[0] = '0' + (cd / 1000) % 10;
+      buf[1] = '0' + (cd / 100) % 10;
+      buf[2] = '0' + (cd / 10) % 10;
+      buf[3] = '0' + cd % 10;
+      buf[4] = (code < 0) ? '-' : ' ';
+      buf += 5;
+    }
+  c->last_reply = cd;
+  return buf;
+}
+
+/**
+ * cli_line_end - finish a reply line started by cli_line_start()
+ * @c: CLI connection
+ * @end: end of the line text written
+ *
+ * The space reserved by cli_line_start() and not used is returned.
+ */
+void
+cli_line_end(cli *c, byte *end)
+{
+  *end++ = '\n';
+  ASSERT(end <= c->tx_write->wpos);
+  c->tx_write->wpos = end;
+}
+
 static void
 cli_copy_message(cli *c)
 {
@@ -18,6 +18,7 @@
 
 #define CLI_MSG_SIZE 500
 #define CLI_LINE_SIZE 512
+#define CLI_MAX_LINE_TEXT (CLI_TX_BUF_SIZE - 6)	/* Longest line for cli_line_start() */
 
 struct cli_out {
   struct cli_out *next;
@@ -53,6 +54,8 @@ extern struct cli *this_cli;		/* Used during parsing */
 
 void cli_printf(cli *, int, char *, ...);
 #define cli_msg(x...) cli_printf(this_cli, x)
+byte *cli_line_start(cli *, int code, int max);
+void cli_line_end(cli *, byte *end);
 void cli_set_log_echo(cli *, unsigned int mask, unsigned int size);
 
 /* Functions provided to sysdep layer */
@@ -6,6 +6,8 @@
  *	Can be freely distributed and used under the terms of the GNU GPL.
  */
 
+#include <stdlib.h>
+
 #include "nest/bird.h"
 #include "nest/route.h"
 #include "nest/cli.h"
@@ -13,6 +15,8 @@
 #include "nest/cmds.h"
 #include "lib/string.h"
 #include "lib/resource.h"
+#include "lib/perf.h"
+#include "nest/protocol.h"
 
 void
 cmd_show_status(void)
@@ -29,6 +33,8 @@ cmd_show_status(void)
   cli_msg(-1011, "Last reboot on %s", tim);
   tm_format_datetime(tim, &config->tf_base, config->load_time);
   cli_msg(-1011, "Last reconfiguration on %s", tim);
+  if (log_dropped)
+    cli_msg(-1011, "Log messages dropped: %u", log_dropped);
   if (shutting_down)
     cli_msg(13, "Shutdown in progress");
   else if (old_config)
@@ -59,7 +65,7 @@ cmd_show_symbols(struct sym_show_data *sd)
 }
 
 static void
-print_size(char *dsc, size_t val)
+print_size_count(char *dsc, size_t val, char *what, unsigned cnt)
 {
   char *px = " kMG";
   int i = 0;
@@ -69,22 +75,119 @@ print_size(char *dsc, size_t val)
       i++;
     }
 
-  cli_msg(-1018, "%-17s %4u %cB", dsc, (unsigned) val, px[i]);
+  if (what)
+    cli_msg(-1018, "%-17s %4u %cB %10u %s", dsc, (unsigned) val, px[i], cnt, what);
+  else
+    cli_msg(-1018, "%-17s %4u %cB", dsc, (unsigned) val, px[i]);
 }
 
+static inline void
+print_size(char *dsc, size_t val)
+{ print_size_count(dsc, val, NULL, 0); }
+
 extern pool *rt_table_pool;
 extern pool *rta_pool;
 extern pool *roa_pool;
 extern pool *proto_pool;
 
+static void
+print_ratio(char *dsc, size_t a, size_t b)
+{
+  unsigned r = b ? (unsigned) ((100 * (u64) a + b / 2) / b) : 100;
+  cli_msg(-1018, "%-17s %4u.%02u", dsc, r / 100, r % 100);
+}
+
 void
 cmd_show_memory(void)
 {
+  struct rta_mem_stats rs;
+  rta_get_mem_stats(&rs);
+
   cli_msg(-1018, "BIRD memory usage");
   print_size("Routing tables:", rmemsize(rt_table_pool));
   print_size("Route attributes:", rmemsize(rta_pool));
+  print_size_count("  Entries:", rs.rta_mem, "cached", rs.rta_count);
+  print_size("  Next hops:", rs.mpnh_mem);
+  print_size_count("  Lists:", rs.ea_mem, "cached", rs.ea_count);
+  print_size_count("  Data:", rs.adata_mem, "shared", rs.adata_count);
+  cli_msg(-1018, "%-17s %18u references", "", rs.adata_refs);
+  print_ratio("  Data sharing:", rs.adata_ref_bytes, rs.adata_bytes);
   print_size("ROA tables:", rmemsize(roa_pool));
   print_size("Protocols:", rmemsize(proto_pool));
   print_size("Total:", rmemsize(&root_pool));
   cli_msg(0, "");
 }
+
+static void
+print_perf_hist(char *dsc, struct perf_hist *h)
+{
+  cli_msg(-1023, "%-16s %7u %7u %7u %7u %7u %7u %7u %12lu", dsc,
+	  h->count[0], h->count[1], h->count[2], h->count[3], h->count[4], h->count[5], h->count[6],
+	  (unsigned long) (h->time / 1000000));
+}
+
+void
+cmd_show_perf(void)
+{
+  byte tim[TM_DATETIME_BUFFER_SIZE];
+  unsigned i;
+
+  tm_format_datetime(tim, &config->tf_base, perf_reset_time ? perf_reset_time : boot_time);
+  cli_msg(-1023, "Performance counters since %s", tim);
+  cli_msg(-2023, "%-16s %12s %12s %12s %12s", "Operation", "Calls", "Total ms", "Avg us", "Max us");
+  for (i = 0; i < PERF_MAX; i++)
+    {
+      struct perf_counter *c = &perf_counters[i];
+      u64 avg = c->calls ? c->time / c->calls : 0;
+      cli_msg(-1023, "%-16s %12lu %12lu %9lu.%02u %12lu", perf_counter_names[i],
+	      (unsigned long) c->calls, (unsigned long) (c->time / 1000000),
+	      (unsigned long) (avg / 1000), (unsigned) (avg % 1000) / 10,
+	      (unsigned long) (c->max / 1000));
+    }
+
+  cli_msg(-2023, "%-16s %7s %7s %7s %7s %7s %7s %7s %12s", "Hook duration",
+	  "<10us", "<100us", "<1ms", "<10ms", "<100ms", "<1s", ">=1s", "Total ms");
+  print_perf_hist("Events", &perf_event_hist);
+  print_perf_hist("Timers", &perf_timer_hist);
+  rt_show_perf();
+}
+
+void
+cmd_reset_perf(void)
+{
+  perf_reset();
+  protos_reset_perf();
+  rt_reset_perf();
+  cli_msg(18, "Performance counters reset");
+}
+
+static int
+watchdog_cmp(const void *a, const void *b)
+{
+  const struct watchdog_entry *x = a, *y = b;
+
+  return (x->max < y->max) - (x->max > y->max);
+}
+
+void
+cmd_show_watchdog(void)
+{
+  struct watchdog_entry top[WATCHDOG_SLOTS];
+  byte tim[TM_DATETIME_BUFFER_SIZE];
+  unsigned i;
+
+  memcpy(top, watchdog_top, sizeof(top));
+  qsort(top, WATCHDOG_SLOTS, sizeof(struct watchdog_entry), watchdog_cmp);
+
+  if (config->watchdog_warning)
+    cli_msg(-1024, "Hooks running over %u ms are logged", config->watchdog_warning);
+  cli_msg(-2024, "%-5s %8s %10s %10s %-20s %s", "Type", "Count", "Total ms", "Max ms", "Max at", "Hook");
+  for (i = 0; (i < WATCHDOG_SLOTS) && top[i].hook; i++)
+    {
+      tm_format_datetime(tim, &config->tf_base, top[i].last);
+      cli_msg(-1024, "%-5s %8u %10lu %10lu %-20s %s", watchdog_kind_names[top[i].kind], top[i].count,
+	      (unsigned long) (top[i].time / 1000000), (unsigned long) (top[i].max / 1000000),
+	      tim, top[i].name);
+    }
+  cli_msg(0, "");
+}
@@ -14,3 +14,6 @@ struct sym_show_data {
 void cmd_show_status(void);
 void cmd_show_symbols(struct sym_show_data *sym);
 void cmd_show_memory(void);
+void cmd_show_perf(void);
+void cmd_reset_perf(void);
+void cmd_show_watchdog(void);
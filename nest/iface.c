@@ -21,6 +21,10 @@
  * The interface module keeps a `soft-up' state for each &iface which
  * is a conjunction of link being up, the interface being of a `sane'
  * type and at least one IP address assigned to it.
+ *
+ * Besides the list of all interfaces, there are hash tables indexed by
+ * interface index and name, so interfaces reported by the kernel can
+ * be found quickly even if there are thousands of them.
  */
 
 #undef LOCAL_DEBUG
@@ -39,6 +43,88 @@ static void auto_router_id(void);
 
 list iface_list;
 
+static struct iface **if_index_hash, **if_name_hash;
+static unsigned if_hash_size = 64;
+static unsigned if_hash_count;
+
+static inline unsigned
+if_hash_index(unsigned idx)
+{
+  return (idx ^ (idx >> 8)) & (if_hash_size - 1);
+}
+
+static inline unsigned
+if_hash_name(char *name)
+{
+  unsigned h = 0;
+
+  while (*name)
+    h = (h * 31) + (byte) *name++;
+  return (h ^ (h >> 16)) & (if_hash_size - 1);
+}
+
+static void
+if_hash_insert(struct iface *i)
+{
+  unsigned h = if_hash_index(i->index);
+  i->next_index = if_index_hash[h];
+  if_index_hash[h] = i;
+
+  h = if_hash_name(i->name);
+  i->next_name = if_name_hash[h];
+  if_name_hash[h] = i;
+}
+
+static void
+if_alloc_hash(void)
+{
+  if_index_hash = mb_allocz(if_pool, sizeof(struct iface *) * if_hash_size);
+  if_name_hash = mb_allocz(if_pool, sizeof(struct iface *) * if_hash_size);
+}
+
+static void
+if_rehash(void)
+{
+  struct iface **oht = if_name_hash;
+  struct iface *i, *n;
+  unsigned h, ohs = if_hash_size;
+
+  mb_free(if_index_hash);
+  if_hash_size *= 2;
+  if_alloc_hash();
+  for (h = 0; h < ohs; h++)
+    for (i = oht[h]; i; i = n)
+      {
+	n = i->next_name;
+	if_hash_insert(i);
+      }
+  mb_free(oht);
+}
+
+static void
+if_hash_add(struct iface *i)
+{
+  if (++if_hash_count > 2 * if_hash_size)
+    if_rehash();
+  if_hash_insert(i);
+}
+
+static void
+if_hash_remove(struct iface *i)
+{
+  struct iface **ip;
+
+  for (ip = &if_index_hash[if_hash_index(i->index)]; *ip != i; ip = &(*ip)->next_index)
+    ;
+  *ip = i->next_index;
+
+  for (ip = &if_name_hash[if_hash_name(i->name)]; *ip != i; ip = &(*ip)->next_name)
+    ;
+  *ip = i->next_name;
+
+  if_hash_count--;
+}
+
 /**
  * ifa_dump - dump interface address
  * @a: interface address descriptor
@@ -292,31 +378,31 @@ if_update(struct iface *new)
   struct iface *i;
   unsigned c;
 
-  WALK_LIST(i, iface_list)
-    if (!strcmp(new->name, i->name))
-      {
-	new->addr = i->addr;
-	new->flags = if_recalc_flags(new, new->flags);
-	c = if_what_changed(i, new);
-	if (c & IF_CHANGE_TOO_MUCH)	/* Changed a lot, convert it to down/up */
-	  {
-	    DBG("Interface %s changed too much -- forcing down/up transition\n", i->name);
-	    if_change_flags(i, i->flags | IF_TMP_DOWN);
-	    rem_node(&i->n);
-	    new->addr = i->addr;
-	    memcpy(&new->addrs, &i->addrs, sizeof(i->addrs));
-	    memcpy(i, new, sizeof(*i));
-	    i->flags &= ~IF_UP; /* IF_TMP_DOWN will be added later */
-	    goto newif;
-	  }
+  if (i = if_find_by_name(new->name))
+    {
+      new->addr = i->addr;
+      new->flags = if_recalc_flags(new, new->flags);
+      c = if_what_changed(i, new);
+      if (c & IF_CHANGE_TOO_MUCH)	/* Changed a lot, convert it to down/up */
+	{
+	  DBG("Interface %s changed too much -- forcing down/up transition\n", i->name);
+	  if_change_flags(i, i->flags | IF_TMP_DOWN);
+	  rem_node(&i->n);
+	  if_hash_remove(i);
+	  new->addr = i->addr;
+	  memcpy(&new->addrs, &i->addrs, sizeof(i->addrs));
+	  memcpy(i, new, sizeof(*i));
+	  i->flags &= ~IF_UP; /* IF_TMP_DOWN will be added later */
+	  goto newif;
+	}
 
-	if_copy(i, new);
-	if (c)
-	  if_notify_change(c, i);
+      if_copy(i, new);
+      if (c)
+	if_notify_change(c, i);
 
-	i->flags |= IF_UPDATED;
-	return i;
-      }
+      i->flags |= IF_UPDATED;
+      return i;
+    }
   i = mb_alloc(if_pool, sizeof(struct iface));
   memcpy(i, new, sizeof(*i));
   init_list(&i->addrs);
@@ -324,6 +410,7 @@ newif:
   init_list(&i->neighbors);
   i->flags |= IF_UPDATED | IF_TMP_DOWN;		/* Tmp down as we don't have addresses yet */
   add_tail(&iface_list, &i->n);
+  if_hash_add(i);
   return i;
 }
 
@@ -418,7 +505,7 @@ if_find_by_index(unsigned idx)
 {
   struct iface *i;
 
-  WALK_LIST(i, iface_list)
+  for (i = if_index_hash[if_hash_index(idx)]; i; i = i->next_index)
     if (i->index == idx && !(i->flags & IF_SHUTDOWN))
       return i;
   return NULL;
@@ -437,7 +524,7 @@ if_find_by_name(char *name)
 {
   struct iface *i;
 
-  WALK_LIST(i, iface_list)
+  for (i = if_name_hash[if_hash_name(name)]; i; i = i->next_name)
     if (!strcmp(i->name, name))
       return i;
   return NULL;
@@ -458,6 +545,7 @@ if_get_by_name(char *name)
   init_list(&i->addrs);
   init_list(&i->neighbors);
   add_tail(&iface_list, &i->n);
+  if_hash_add(i);
   return i;
 }
 
@@ -543,6 +631,7 @@ ifa_update(struct ifa *a)
   memcpy(b, a, sizeof(struct ifa));
   add_tail(&i->addrs, &b->n);
   b->flags = (i->flags & ~IA_FLAGS) | (a->flags & IA_FLAGS);
+  neigh_prefix_add(b);
   if (ifa_recalc_primary(i))
     if_change_flags(i, i->flags | IF_TMP_DOWN);
   if (b->flags & IF_UP)
@@ -578,6 +667,7 @@ ifa_delete(struct ifa *a)
 	    if_change_flags(i, i->flags | IF_TMP_DOWN);
 	    ifa_recalc_primary(i);
 	  }
+	neigh_prefix_remove(b);
 	mb_free(b);
 	return;
       }
@@ -615,6 +705,7 @@ if_init(void)
 {
   if_pool = rp_new(&root_pool, "Interfaces");
   init_list(&iface_list);
+  if_alloc_hash();
   neigh_init(if_pool);
 }
 
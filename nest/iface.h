@@ -37,6 +37,8 @@ struct iface {
   list addrs;				/* Addresses assigned to this interface */
   struct ifa *addr;			/* Primary address */
   list neighbors;			/* All neighbors on this interface */
+  struct iface *next_index;		/* Next in hash chain of indices */
+  struct iface *next_name;		/* Next in hash chain of names */
 };
 
 #define IF_UP 1				/* IF_ADMIN_UP and IP address known */
@@ -136,6 +138,8 @@ void neigh_if_up(struct iface *);
 void neigh_if_down(struct iface *);
 void neigh_if_link(struct iface *);
 void neigh_ifa_update(struct ifa *);
+void neigh_prefix_add(struct ifa *);
+void neigh_prefix_remove(struct ifa *);
 void neigh_init(struct pool *);
 
 /*
@@ -15,10 +15,15 @@
 
 /* MRTdump types */
 
+#define TABLE_DUMP_V2		13
 #define BGP4MP			16
 
 /* MRTdump subtypes */
 
+#define PEER_INDEX_TABLE	1
+#define RIB_IPV4_UNICAST	2
+#define RIB_IPV6_UNICAST	4
+
 #define BGP4MP_MESSAGE		1
 #define BGP4MP_MESSAGE_AS4	4
 #define BGP4MP_STATE_CHANGE_AS4	5
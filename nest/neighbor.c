@@ -35,6 +35,14 @@
  * When a neighbor event occurs (a neighbor gets disconnected or a sticky
  * inactive neighbor becomes connected), the protocol hook neigh_notify()
  * is called to advertise the change.
+ *
+ * To find the interface an unknown neighbor is connected through, the
+ * cache keeps an index of connected prefixes (and addresses of peers
+ * on point-to-point links), each pointing to the interfaces having such
+ * a prefix. It is maintained by ifa_update() and ifa_delete() and
+ * looked up in a longest-match manner, so the interface list need not
+ * be walked. An address change revisits only neighbors covered by
+ * the changed address.
  */
 
 #undef LOCAL_DEBUG
@@ -42,6 +50,7 @@
 #include "nest/bird.h"
 #include "nest/iface.h"
 #include "nest/protocol.h"
+#include "nest/route.h"
 #include "lib/resource.h"
 
 #define NEIGH_HASH_SIZE 256
@@ -49,6 +58,21 @@
 static slab *neigh_slab;
 static list sticky_neigh_list, neigh_hash_table[NEIGH_HASH_SIZE];
 
+struct neigh_prefix {			/* Connected prefix */
+  struct fib_node n;
+  struct neigh_pxref *refs;		/* Interfaces having this prefix */
+};
+
+struct neigh_pxref {
+  struct neigh_pxref *next;
+  struct iface *iface;
+  unsigned uc;				/* Number of addresses of the iface */
+};
+
+static struct fib neigh_prefix_fib;
+static slab *neigh_pxref_slab;
+static unsigned neigh_prefix_count[BITS_PER_IP_ADDRESS+1];	/* Prefixes per length */
+
 static inline unsigned int
 neigh_hash(struct proto *p, ip_addr *a)
 {
@@ -89,6 +113,138 @@ if_connected(ip_addr *a, struct iface *i) /* -1=error, 1=match, 0=no match */
   return -1;
 }
 
+static void
+neigh_prefix_init(struct fib_node *N)
+{
+  struct neigh_prefix *px = (struct neigh_prefix *) N;
+  px->refs = NULL;
+}
+
+static void
+neigh_prefix_ref(struct iface *i, ip_addr a, int len)
+{
+  struct neigh_prefix *px;
+  struct neigh_pxref *r;
+
+  a = ipa_and(a, ipa_mkmask(len));
+  px = fib_get(&neigh_prefix_fib, &a, len);
+  if (!px->refs)
+    neigh_prefix_count[len]++;
+  for (r = px->refs; r; r = r->next)
+    if (r->iface == i)
+      {
+	r->uc++;
+	return;
+      }
+  r = sl_alloc(neigh_pxref_slab);
+  r->iface = i;
+  r->uc = 1;
+  r->next = px->refs;
+  px->refs = r;
+}
+
+static void
+neigh_prefix_unref(struct iface *i, ip_addr a, int len)
+{
+  struct neigh_prefix *px;
+  struct neigh_pxref *r, **rp;
+
+  a = ipa_and(a, ipa_mkmask(len));
+  px = fib_find(&neigh_prefix_fib, &a, len);
+  if (!px)
+    return;
+  for (rp = &px->refs; r = *rp; rp = &r->next)
+    if (r->iface == i)
+      {
+	if (!--r->uc)
+	  {
+	    *rp = r->next;
+	    sl_free(neigh_pxref_slab, r);
+	  }
+	break;
+      }
+  if (!px->refs)
+    {
+      neigh_prefix_count[len]--;
+      fib_delete(&neigh_prefix_fib, px);
+    }
+}
+
+/**
+ * neigh_prefix_add - add an interface address to the connected prefix index
+ * @a: interface address
+ *
+ * Called by ifa_update() when a new address is attached to an interface.
+ */
+void
+neigh_prefix_add(struct ifa *a)
+{
+  if (a->flags & IA_PEER)
+    {
+      neigh_prefix_ref(a->iface, a->opposite, BITS_PER_IP_ADDRESS);
+      neigh_prefix_ref(a->iface, a->ip, BITS_PER_IP_ADDRESS);
+    }
+  else
+    neigh_prefix_ref(a->iface, a->prefix, a->pxlen);
+}
+
+/**
+ * neigh_prefix_remove - remove an interface address from the connected prefix index
+ * @a: interface address
+ *
+ * Called by ifa_delete() before the address is freed.
+ */
+void
+neigh_prefix_remove(struct ifa *a)
+{
+  if (a->flags & IA_PEER)
+    {
+      neigh_prefix_unref(a->iface, a->opposite, BITS_PER_IP_ADDRESS);
+      neigh_prefix_unref(a->iface, a->ip, BITS_PER_IP_ADDRESS);
+    }
+  else
+    neigh_prefix_unref(a->iface, a->prefix, a->pxlen);
+}
+
+/*
+ * Find the interface with the longest connected prefix covering @a
+ * for which if_connected() succeeds. Returns its scope or -1.
+ */
+static int
+neigh_prefix_lookup(ip_addr *a, struct iface **ifp)
+{
+  struct neigh_prefix *px;
+  struct neigh_pxref *r;
+  ip_addr a0;
+  int len, scope;
+
+  for (len = BITS_PER_IP_ADDRESS; len >= 0; len--)
+    {
+      if (!neigh_prefix_count[len])
+	continue;
+      a0 = ipa_and(*a, ipa_mkmask(len));
+      if (!(px = fib_find(&neigh_prefix_fib, &a0, len)))
+	continue;
+      for (r = px->refs; r; r = r->next)
+	if ((scope = if_connected(a, r->iface)) >= 0)
+	  {
+	    *ifp = r->iface;
+	    return scope;
+	  }
+    }
+  return -1;
+}
+
+static inline int
+ifa_covers(struct ifa *b, ip_addr *a)
+{
+  if (ipa_equal(*a, b->ip))
+    return 1;
+  if (b->flags & IA_PEER)
+    return ipa_equal(*a, b->opposite);
+  return ipa_in_net(*a, b->prefix, b->pxlen);
+}
+
 /**
  * neigh_find - find or create a neighbor entry.
  * @p: protocol which asks for the entry.
@@ -116,7 +272,6 @@ neigh_find2(struct proto *p, ip_addr *a, struct iface *ifa, unsigned flags)
   neighbor *n;
   int class, scope = -1;       ;
   unsigned int h = neigh_hash(p, a);
-  struct iface *i;
 
   WALK_LIST(n, neigh_hash_table[h])	/* Search the cache */
     if (n->proto == p && ipa_equal(*a, n->addr) && (!ifa || (ifa == n->iface)))
@@ -139,12 +294,7 @@ neigh_find2(struct proto *p, ip_addr *a, struct iface *ifa, unsigned flags)
 	scope = class & IADDR_SCOPE_MASK;
     }
   else
-    WALK_LIST(i, iface_list)
-      if ((scope = if_connected(a, i)) >= 0)
-	{
-	  ifa = i;
-	  break;
-	}
+    scope = neigh_prefix_lookup(a, &ifa);
 
   /* scope < 0 means i don't know neighbor */
   /* scope >= 0 implies ifa != NULL */
@@ -314,25 +464,31 @@ neigh_if_link(struct iface *i)
  * Tell the neighbor cache that an address was added or removed.
  *
  * The neighbor cache wakes up all inactive sticky neighbors with
- * addresses belonging to prefixes of the interface belonging to @ifa
- * and causes all unreachable neighbors to be flushed.
+ * addresses covered by @ifa and causes all neighbors covered by it
+ * which became unreachable to be flushed. Other neighbors cannot be
+ * affected by the change.
  */
 void
 neigh_ifa_update(struct ifa *a)
 {
   struct iface *i = a->iface;
+  neighbor *n, *next;
   node *x, *y;
+  int scope;
 
   /* Remove all neighbors whose scope has changed */
   WALK_LIST_DELSAFE(x, y, i->neighbors)
     {
-      neighbor *n = SKIP_BACK(neighbor, if_n, x);
-      if (if_connected(&n->addr, i) != n->scope)
+      n = SKIP_BACK(neighbor, if_n, x);
+      if (ifa_covers(a, &n->addr) && (if_connected(&n->addr, i) != n->scope))
 	neigh_down(n);
     }
 
   /* Wake up all sticky neighbors that are reachable now */
-  neigh_if_up(i);
+  WALK_LIST_DELSAFE(n, next, sticky_neigh_list)
+    if ((!n->iface || n->iface == i) && ifa_covers(a, &n->addr) &&
+	((scope = if_connected(&n->addr, i)) >= 0))
+      neigh_up(n, i, scope);
 }
 
 static inline void
@@ -381,6 +537,8 @@ neigh_init(pool *if_pool)
   int i;
 
   neigh_slab = sl_new(if_pool, sizeof(neighbor));
+  neigh_pxref_slab = sl_new(if_pool, sizeof(struct neigh_pxref));
+  fib_init(&neigh_prefix_fib, if_pool, sizeof(struct neigh_prefix), 0, neigh_prefix_init);
   init_list(&sticky_neigh_list);
   for(i=0; i<NEIGH_HASH_SIZE; i++)
     init_list(&neigh_hash_table[i]);
@@ -212,6 +212,8 @@ proto_free_ahooks(struct proto *p)
   for(h = p->ahooks; h; h = hn)
   {
     hn = h->next;
+    if (h->roa_rejected)
+      roa_free_set(h->roa_rejected);
     mb_free(h);
   }
 
@@ -747,6 +749,9 @@ protos_build(void)
 #endif
 #ifdef CONFIG_BGP
   proto_build(&proto_bgp);
+#endif
+#ifdef CONFIG_MRT
+  proto_build(&proto_mrt);
 #endif
   proto_pool = rp_new(&root_pool, "Protocols");
   proto_flush_event = ev_new(proto_pool);
@@ -1329,6 +1334,31 @@ proto_apply_cmd_symbol(struct symbol *s, void (* cmd)(struct proto *, unsigned i
   cli_msg(0, "");
 }
 
+void
+proto_cmd_show_perf(struct proto *p, unsigned int arg UNUSED, int cnt)
+{
+  if (!cnt)
+    cli_msg(-2023, "%-16s %12s %12s %12s %12s", "Protocol", "RX packets", "TX packets", "Routes in", "Routes out");
+
+  cli_msg(-1023, "%-16s %12u %12u %12u %12u", p->name, p->perf.rx_packets, p->perf.tx_packets,
+	  p->perf.routes_in, p->perf.routes_out);
+}
+
+/**
+ * protos_reset_perf - clear performance counters of all protocols
+ */
+void
+protos_reset_perf(void)
+{
+  node *nn;
+
+  WALK_LIST(nn, proto_list)
+    {
+      struct proto *p = SKIP_BACK(struct proto, glob_node, nn);
+      bzero(&p->perf, sizeof(struct proto_perf));
+    }
+}
+
 static void
 proto_apply_cmd_patt(char *patt, void (* cmd)(struct proto *, unsigned int, int), unsigned int arg)
 {
@@ -75,7 +75,7 @@ void protos_dump_all(void);
 
 extern struct protocol
   proto_device, proto_radv, proto_rip, proto_static,
-  proto_ospf, proto_pipe, proto_bgp;
+  proto_ospf, proto_pipe, proto_bgp, proto_mrt;
 
 /*
  *	Routing Protocol Instance
@@ -129,6 +129,13 @@ struct proto_stats {
   u32 exp_withdraws_accepted;	/* Number of route withdraws accepted and processed */
 };
 
+/* Protocol performance counters, see 'show perf' */
+struct proto_perf {
+  u32 rx_packets, tx_packets;	/* Number of packets received and sent */
+  u32 routes_in;		/* Number of route updates and withdraws received from the protocol */
+  u32 routes_out;		/* Number of route updates and withdraws announced to the protocol */
+};
+
 struct proto {
   node n;				/* Node in *_proto_list */
   node glob_node;			/* Node in global proto_list */
@@ -156,6 +163,7 @@ struct proto {
   bird_clock_t last_state_change;	/* Time of last state transition */
   char *last_state_name_announced;	/* Last state name we've announced to the user */
   struct proto_stats stats;		/* Current protocol statistics */
+  struct proto_perf perf;		/* Performance counters */
 
   /*
    *	General protocol hooks:
@@ -242,6 +250,8 @@ void proto_show_limit(struct proto_limit *l, const char *dsc);
 void proto_show_basic_info(struct proto *p);
 
 void proto_cmd_show(struct proto *, unsigned int, int);
+void proto_cmd_show_perf(struct proto *, unsigned int, int);
+void protos_reset_perf(void);
 void proto_cmd_disable(struct proto *, unsigned int, int);
 void proto_cmd_enable(struct proto *, unsigned int, int);
 void proto_cmd_restart(struct proto *, unsigned int, int);
@@ -416,6 +426,10 @@ struct announce_hook {
   struct proto_limit *in_limit;		/* Input limit */
   struct proto_limit *out_limit;	/* Output limit */
   struct proto_stats *stats;		/* Per-table protocol statistics */
+  struct roa_table *roa_rejected;	/* Prefixes of routes rejected by a filter using ROA, or NULL */
+  byte roa_changed;			/* A ROA table used by in_filter has changed */
+  byte roa_reval;			/* Routes are being revalidated due to such change */
+  byte roa_reload;			/* Reload routes after the revalidation */
   struct announce_hook *next;		/* Next hook for the same protocol */
 };
 
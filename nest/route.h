@@ -124,6 +124,14 @@ struct rtable_config {
   byte sorted;				/* Routes of network are sorted according to rte_better() */
 };
 
+struct nhu_stats {
+  u32 runs;				/* Finished Next Hop Updates */
+  u32 nets, routes;			/* Nets visited and routes updated in the last one */
+  u64 time;				/* Time spent in the last one (in us) */
+  u32 cur_nets, cur_routes;		/* The same for the running one */
+  u64 cur_time;
+};
+
 typedef struct rtable {
   node n;				/* Node in list of all tables */
   struct fib fib;
@@ -143,9 +151,13 @@ typedef struct rtable {
   byte gc_scheduled;			/* GC is scheduled */
   byte prune_state;			/* Table prune state, 1 -> prune is running */
   byte hcu_scheduled;			/* Hostcache update is scheduled */
-  byte nhu_state;			/* Next Hop Update state */
   struct fib_iterator prune_fit;	/* Rtable prune FIB iterator */
-  struct fib_iterator nhu_fit;		/* Next Hop Update FIB iterator */
+  list nhu_list;			/* Hostentries waiting for Next Hop Update (nhu_n) */
+  struct hostdeps *hostdeps;		/* Nets depending on hostentries, or NULL */
+  struct nhu_stats nhu_stats;		/* Next Hop Update statistics */
+  struct roa_table *roa_changed;	/* Changed ROA prefixes waiting for revalidation, or NULL */
+  struct roa_table *roa_reval;		/* Changed ROA prefixes being revalidated, or NULL */
+  struct fib_iterator reval_fit;	/* Rtable revalidation FIB iterator */
 } rtable;
 
 typedef struct network {
@@ -161,7 +173,12 @@ struct hostcache {
   unsigned hash_items;
   linpool *lp;				/* Linpool for trie */
   struct f_trie *trie;			/* Trie of prefixes that might affect hostentries */
+  unsigned trie_stale;			/* Number of obsolete ranges in the trie */
   list hostentries;			/* List of all hostentries */
+  list updates;				/* Hostentries to be resolved again (un) */
+  unsigned new_items;			/* Hostentries created since the last cleanup */
+  struct fib prefixes;			/* Hostentries by prefix they are resolved through (struct hc_prefix) */
+  unsigned px_count[MAX_PREFIX_LENGTH+1]; /* Number of such prefixes of each length */
   byte update_hostcache;
 };
 
@@ -177,7 +194,15 @@ struct hostentry {
   struct rta *src;			/* Source rta entry */
   ip_addr gw;				/* Chosen next hop */
   byte dest;				/* Chosen route destination type (RTD_...) */
+  byte nhu_pending;			/* Waiting in tab->nhu_list */
   u32 igp_metric;			/* Chosen route IGP metric */
+  list deps;				/* Nets in tab using this hostentry (struct hostdep) */
+  node nhu_n;				/* Node in tab->nhu_list */
+  node *nhu_pos;			/* Next dependent net to be updated */
+  struct hc_prefix *px;			/* Prefix of the route the host is resolved through */
+  node pxn;				/* Node in px->hostentries */
+  node un;				/* Node in hostcache->updates */
+  byte update_pending;			/* Waiting in hostcache->updates */
 };
 
 typedef struct rte {
@@ -195,6 +220,7 @@ typedef struct rte {
       node garbage;			/* List for garbage collection */
       byte metric;			/* RIP metric */
       u16 tag;				/* External route tag */
+      u32 queued;			/* Position in the garbage list (lastmod may be newer) */
       struct rip_entry *entry;
     } rip;
 #endif
@@ -248,10 +274,13 @@ rte *rte_do_cow(rte *);
 static inline rte * rte_cow(rte *r) { return (r->flags & REF_COW) ? rte_do_cow(r) : r; }
 void rt_dump(rtable *);
 void rt_dump_all(void);
+void rt_show_perf(void);
+void rt_reset_perf(void);
 int rt_feed_baby(struct proto *p);
 void rt_feed_baby_abort(struct proto *p);
 void rt_schedule_prune_all(void);
 int rt_prune_loop(void);
+void rt_roa_changed(struct roa_table *t, ip_addr prefix, int pxlen);
 struct rtable_config *rt_new_table(struct symbol *s);
 
 struct rt_show_data {
@@ -267,6 +296,7 @@ struct rt_show_data {
   struct config *running_on_config;
   int net_counter, rt_counter, show_counter;
   int stats, show_for;
+  int json;				/* Machine-readable output, one JSON object per route */
 };
 void rt_show(struct rt_show_data *);
 
@@ -412,6 +442,7 @@ void ea_merge(ea_list *from, ea_list *to); /* Merge sub-lists to allocated buffe
 int ea_same(ea_list *x, ea_list *y);	/* Test whether two ea_lists are identical */
 unsigned int ea_hash(ea_list *e);	/* Calculate 16-bit hash value */
 ea_list *ea_append(ea_list *to, ea_list *what);
+struct adata *adata_intern(struct adata *d); /* Get shared copy of attribute data */
 
 int mpnh__same(struct mpnh *x, struct mpnh *y); /* Compare multipath nexthops */
 static inline int mpnh_same(struct mpnh *x, struct mpnh *y)
@@ -425,6 +456,16 @@ static inline void rta_free(rta *r) { if (r && !--r->uc) rta__free(r); }
 void rta_dump(rta *);
 void rta_dump_all(void);
 void rta_show(struct cli *, rta *, ea_list *);
+extern char *rta_src_names[];		/* Names of route sources, indexed by RTS_* */
+
+struct rta_mem_stats {
+  size_t rta_mem, mpnh_mem, ea_mem, adata_mem;	/* Memory used by parts of the cache */
+  unsigned int rta_count, ea_count;		/* Number of cached rtas and ea_lists */
+  unsigned int adata_count, adata_refs;		/* Shared attribute data and references to them */
+  size_t adata_bytes, adata_ref_bytes;		/* Size of shared data and size if not shared */
+};
+
+void rta_get_mem_stats(struct rta_mem_stats *s);
 void rta_set_recursive_next_hop(rtable *dep, rta *a, rtable *tab, ip_addr *gw, ip_addr *ll);
 
 /*
@@ -475,13 +516,15 @@ struct roa_item {
 
 struct roa_node {
   struct fib_node n;
-  struct roa_item *items;
-  // u32 cached_asn;
+  struct roa_item *items;		/* ROA entries, NULL for glue nodes */
+  struct roa_node *parent;		/* Nearest covering node in the trie */
+  struct roa_node *child[2];		/* Subtries according to the next bit */
 };
 
 struct roa_table {
   node n;				/* Node in roa_table_list */
   struct fib fib;
+  struct roa_node *root;		/* Root of the covering prefix trie */
   char *name;				/* Name of this ROA table */
   struct roa_table_config *cf;		/* Configuration of this ROA table */
 };
@@ -539,6 +582,14 @@ void roa_init(void);
 void roa_preconfig(struct config *c);
 void roa_commit(struct config *new, struct config *old);
 void roa_show(struct roa_show_data *d);
+struct roa_table *roa_new_set(void);
+void roa_free_set(struct roa_table *s);
+static inline void roa_set_add(struct roa_table *s, ip_addr prefix, byte pxlen)
+{ roa_add_item(s, prefix, pxlen, 0, 0, ROA_SRC_ANY); }
+static inline void roa_set_del(struct roa_table *s, ip_addr prefix, byte pxlen)
+{ roa_delete_item(s, prefix, pxlen, 0, 0, ROA_SRC_ANY); }
+static inline int roa_set_covers(struct roa_table *s, ip_addr prefix, byte pxlen)
+{ return roa_check(s, prefix, pxlen, 0) != ROA_UNKNOWN; }
 
 
 #endif
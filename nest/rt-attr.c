@@ -42,6 +42,15 @@
  * and they are provided with a use count to allow sharing.
  *
  * Routing tables always contain only cached &rta's.
+ *
+ * Attribute data (&adata) referenced from cached &ea_list's are shared.
+ * They are kept in a separate hash table with use counts, so that
+ * identical AS paths or community lists of different &rta's are stored
+ * just once. Operations like as_path_prepend() or int_set_add() return
+ * shared data directly (see adata_intern()), therefore attribute data of
+ * cached &ea_list's can be compared just by pointers. Parts of the
+ * cache are allocated from their own pools, which allows us to report
+ * memory usage of each of them.
  */
 
 #include "nest/bird.h"
@@ -51,6 +60,7 @@
 #include "nest/cli.h"
 #include "nest/attrs.h"
 #include "lib/alloca.h"
+#include "lib/event.h"
 #include "lib/resource.h"
 #include "lib/string.h"
 
@@ -58,6 +68,8 @@ pool *rta_pool;
 
 static slab *rta_slab;
 static slab *mpnh_slab;
+static pool *ea_pool;
+static pool *adata_pool;
 
 struct protocol *attr_class_to_protocol[EAP_MAX];
 
@@ -346,18 +358,20 @@ ea_merge(ea_list *e, ea_list *t)
  * @y: attribute list
  *
  * ea_same() compares two normalized attribute lists @x and @y and returns
- * 1 if they contain the same attributes, 0 otherwise.
+ * 1 if they contain the same attributes, 0 otherwise. Attribute data of
+ * two cached lists are shared, so they are compared just by pointers.
  */
 int
 ea_same(ea_list *x, ea_list *y)
 {
-  int c;
+  int c, cached;
 
   if (!x || !y)
     return x == y;
   ASSERT(!x->next && !y->next);
   if (x->count != y->count)
     return 0;
+  cached = x->flags & y->flags & EALF_CACHED;
   for(c=0; c<x->count; c++)
     {
       eattr *a = &x->attrs[c];
@@ -365,14 +379,221 @@ ea_same(ea_list *x, ea_list *y)
 
       if (a->id != b->id ||
 	  a->flags != b->flags ||
-	  a->type != b->type ||
-	  ((a->type & EAF_EMBEDDED) ? a->u.data != b->u.data :
-	   (a->u.ptr->length != b->u.ptr->length || memcmp(a->u.ptr->data, b->u.ptr->data, a->u.ptr->length))))
+	  a->type != b->type)
+	return 0;
+      if (a->type & EAF_EMBEDDED)
+	{
+	  if (a->u.data != b->u.data)
+	    return 0;
+	}
+      else if (a->u.ptr != b->u.ptr &&
+	       (cached || a->u.ptr->length != b->u.ptr->length ||
+		memcmp(a->u.ptr->data, b->u.ptr->data, a->u.ptr->length)))
 	return 0;
     }
   return 1;
 }
 
+/*
+ *	Shared attribute data
+ */
+
+struct ea_adata {
+  struct ea_adata *next;		/* Next in hash chain */
+  struct ea_adata *next_unused;		/* Next in list of unreferenced entries */
+  unsigned int hash_key;
+  unsigned int uc;			/* Use count */
+  int unused;				/* Linked in adata_unused list */
+  struct adata ad;			/* Must be the last one */
+};
+
+static unsigned int adata_cache_count;
+static unsigned int adata_cache_size = 32;
+static unsigned int adata_cache_limit;
+static unsigned int adata_cache_mask;
+static struct ea_adata **adata_hash_table;
+static struct ea_adata *adata_unused;	/* Entries with zero use count */
+static event *adata_prune_event;
+
+static unsigned int adata_refs;		/* Number of references to shared data */
+static size_t adata_bytes;		/* Size of shared data */
+static size_t adata_ref_bytes;		/* Size of data as if they were not shared */
+static unsigned int ea_count;		/* Number of cached ea_lists */
+
+static void
+adata_alloc_hash(void)
+{
+  adata_hash_table = mb_allocz(adata_pool, sizeof(struct ea_adata *) * adata_cache_size);
+  if (adata_cache_size < 32768)
+    adata_cache_limit = adata_cache_size * 2;
+  else
+    adata_cache_limit = ~0;
+  adata_cache_mask = adata_cache_size - 1;
+}
+
+static inline unsigned int
+adata_hash(struct adata *d)
+{
+  u32 h = d->length;
+  int size = d->length;
+  byte *z = d->data;
+
+  while (size >= 4)
+    {
+      h = (h * 31) ^ get_u32(z);
+      z += 4;
+      size -= 4;
+    }
+  while (size--)
+    h = (h >> 24) ^ (h << 8) ^ *z++;
+
+  return h ^ (h >> 16);
+}
+
+static inline void
+adata_insert(struct ea_adata *e)
+{
+  unsigned int h = e->hash_key & adata_cache_mask;
+  e->next = adata_hash_table[h];
+  adata_hash_table[h] = e;
+}
+
+static void
+adata_rehash(void)
+{
+  unsigned int ohs = adata_cache_size;
+  unsigned int h;
+  struct ea_adata *e, *n;
+  struct ea_adata **oht = adata_hash_table;
+
+  adata_cache_size = 2*adata_cache_size;
+  DBG("Rehashing adata cache from %d to %d entries.\n", ohs, adata_cache_size);
+  adata_alloc_hash();
+  for(h=0; h<ohs; h++)
+    for(e=oht[h]; e; e=n)
+      {
+	n = e->next;
+	adata_insert(e);
+      }
+  mb_free(oht);
+}
+
+static void
+adata_remove(struct ea_adata *e)
+{
+  struct ea_adata **ep;
+
+  for(ep=&adata_hash_table[e->hash_key & adata_cache_mask]; *ep != e; ep=&(*ep)->next)
+    ;
+  *ep = e->next;
+
+  adata_cache_count--;
+  adata_bytes -= e->ad.length;
+  mb_free(e);
+}
+
+static void
+adata_prune(void *data UNUSED)
+{
+  struct ea_adata *e, *n;
+
+  for(e=adata_unused; e; e=n)
+    {
+      n = e->next_unused;
+      e->unused = 0;
+      if (!e->uc)
+	adata_remove(e);
+    }
+  adata_unused = NULL;
+}
+
+/* Keep the entry at least until the next run of adata_prune() */
+static inline void
+adata_defer(struct ea_adata *e)
+{
+  e->unused = 1;
+  e->next_unused = adata_unused;
+  if (!adata_unused)
+    ev_schedule(adata_prune_event);
+  adata_unused = e;
+}
+
+/*
+ * adata_get - find shared copy of attribute data or create a new one
+ * with zero use count. Unreferenced entries are kept in the adata_unused
+ * list until the next run of adata_prune().
+ */
+static struct ea_adata *
+adata_get(struct adata *d)
+{
+  unsigned int h = adata_hash(d);
+  struct ea_adata *e;
+
+  for(e=adata_hash_table[h & adata_cache_mask]; e; e=e->next)
+    if (e->hash_key == h && e->ad.length == d->length &&
+	((&e->ad == d) || !memcmp(e->ad.data, d->data, d->length)))
+      return e;
+
+  e = mb_alloc(adata_pool, sizeof(struct ea_adata) + d->length);
+  e->hash_key = h;
+  e->uc = 0;
+  e->ad.length = d->length;
+  memcpy(e->ad.data, d->data, d->length);
+  adata_insert(e);
+  adata_bytes += d->length;
+  adata_defer(e);
+
+  if (++adata_cache_count > adata_cache_limit)
+    adata_rehash();
+
+  return e;
+}
+
+/**
+ * adata_intern - get shared copy of attribute data
+ * @d: attribute data
+ *
+ * adata_intern() returns a copy of @d stored in the shared attribute
+ * data cache. Identical data always get the same copy, so that they can be
+ * compared just by pointers. The copy is not referenced by anyone; it is
+ * valid until the current event is finished and it is kept afterwards only
+ * when it has been stored in a cached &rta meanwhile.
+ */
+struct adata *
+adata_intern(struct adata *d)
+{
+  struct ea_adata *e = adata_get(d);
+
+  /* A shared entry could be freed by its last rta_free() right away */
+  if (!e->unused)
+    adata_defer(e);
+
+  return &e->ad;
+}
+
+static inline struct adata *
+adata_lookup(struct adata *d)
+{
+  struct ea_adata *e = adata_get(d);
+
+  e->uc++;
+  adata_refs++;
+  adata_ref_bytes += d->length;
+  return &e->ad;
+}
+
+static void
+adata_free(struct adata *d)
+{
+  struct ea_adata *e = SKIP_BACK(struct ea_adata, ad, d);
+
+  adata_refs--;
+  adata_ref_bytes -= d->length;
+
+  if (!--e->uc && !e->unused)
+    adata_remove(e);
+}
+
 static inline ea_list *
 ea_list_copy(ea_list *o)
 {
@@ -383,20 +604,16 @@ ea_list_copy(ea_list *o)
     return NULL;
   ASSERT(!o->next);
   len = sizeof(ea_list) + sizeof(eattr) * o->count;
-  n = mb_alloc(rta_pool, len);
+  n = mb_alloc(ea_pool, len);
   memcpy(n, o, len);
   n->flags |= EALF_CACHED;
   for(i=0; i<o->count; i++)
     {
       eattr *a = &n->attrs[i];
       if (!(a->type & EAF_EMBEDDED))
-	{
-	  unsigned size = sizeof(struct adata) + a->u.ptr->length;
-	  struct adata *d = mb_alloc(rta_pool, size);
-	  memcpy(d, a->u.ptr, size);
-	  a->u.ptr = d;
-	}
+	a->u.ptr = adata_lookup(a->u.ptr);
     }
+  ea_count++;
   return n;
 }
 
@@ -412,8 +629,9 @@ ea_free(ea_list *o)
 	{
 	  eattr *a = &o->attrs[i];
 	  if (!(a->type & EAF_EMBEDDED))
-	    mb_free(a->u.ptr);
+	    adata_free(a->u.ptr);
 	}
+      ea_count--;
       mb_free(o);
     }
 }
@@ -866,15 +1084,16 @@ rta_dump_all(void)
   debug("\n");
 }
 
+char *rta_src_names[] = { "dummy", "static", "inherit", "device", "static-device", "redirect",
+			 "RIP", "OSPF", "OSPF-IA", "OSPF-E1", "OSPF-E2", "BGP", "pipe" };
+
 void
 rta_show(struct cli *c, rta *a, ea_list *eal)
 {
-  static char *src_names[] = { "dummy", "static", "inherit", "device", "static-device", "redirect",
-			       "RIP", "OSPF", "OSPF-IA", "OSPF-E1", "OSPF-E2", "BGP", "pipe" };
   static char *cast_names[] = { "unicast", "broadcast", "multicast", "anycast" };
   int i;
 
-  cli_printf(c, -1008, "\tType: %s %s %s", src_names[a->source], cast_names[a->cast], ip_scope_text(a->scope));
+  cli_printf(c, -1008, "\tType: %s %s %s", rta_src_names[a->source], cast_names[a->cast], ip_scope_text(a->scope));
   if (!eal)
     eal = a->eattrs;
   for(; eal; eal=eal->next)
@@ -894,7 +1113,34 @@ rta_init(void)
   rta_pool = rp_new(&root_pool, "Attributes");
   rta_slab = sl_new(rta_pool, sizeof(rta));
   mpnh_slab = sl_new(rta_pool, sizeof(struct mpnh));
+  ea_pool = rp_new(rta_pool, "Attribute lists");
+  adata_pool = rp_new(rta_pool, "Attribute data");
   rta_alloc_hash();
+  adata_alloc_hash();
+  adata_prune_event = ev_new(rta_pool);
+  adata_prune_event->hook = adata_prune;
+}
+
+/**
+ * rta_get_mem_stats - get memory usage of attribute cache
+ * @s: structure to be filled in
+ *
+ * Fills in sizes of memory used by particular parts of the route
+ * attribute cache and statistics of sharing of attribute data.
+ */
+void
+rta_get_mem_stats(struct rta_mem_stats *s)
+{
+  s->rta_mem = rmemsize(rta_slab) + sizeof(rta *) * rta_cache_size;
+  s->mpnh_mem = rmemsize(mpnh_slab);
+  s->ea_mem = rmemsize(ea_pool);
+  s->adata_mem = rmemsize(adata_pool);
+  s->rta_count = rta_cache_count;
+  s->ea_count = ea_count;
+  s->adata_count = adata_cache_count;
+  s->adata_refs = adata_refs;
+  s->adata_bytes = adata_bytes;
+  s->adata_ref_bytes = adata_ref_bytes;
 }
 
 /*
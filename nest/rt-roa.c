@@ -26,6 +26,103 @@ static inline int
 src_match(struct roa_item *it, byte src)
 { return !src || it->src == src; }
 
+/* Let routing tables revalidate routes covered by the changed ROA prefix */
+static inline void
+roa_notify(struct roa_table *t, ip_addr prefix, byte pxlen)
+{
+  if (t->cf)
+    rt_roa_changed(t, prefix, pxlen);
+}
+
+
+/*
+ * All nodes of the ROA table FIB are also linked in a path-compressed
+ * binary trie. A node is a child of the longest node covering it, the
+ * child slot is selected by the first bit after the prefix of the
+ * parent. Nodes without ROA entries are kept only as glue nodes with
+ * two children, therefore the depth of the trie is bounded by the
+ * number of ROA prefixes covering the checked prefix plus the number
+ * of branchings, and roa_check() needs just one descent from the root.
+ */
+
+static inline int
+roa_bit(ip_addr a, int pos)
+{ return !!ipa_getbit(a, pos); }
+
+static inline int
+roa_covers(struct roa_node *n, ip_addr px, int pxlen)
+{ return net_in_net(px, pxlen, n->n.prefix, n->n.pxlen); }
+
+static inline struct roa_node **
+roa_link(struct roa_table *t, struct roa_node *n)
+{
+  return n->parent ? &n->parent->child[roa_bit(n->n.prefix, n->parent->n.pxlen)] : &t->root;
+}
+
+static void
+roa_trie_insert(struct roa_table *t, struct roa_node *n)
+{
+  struct roa_node *x = t->root, *parent = NULL, *g;
+  ip_addr px = n->n.prefix;
+  int pxlen = n->n.pxlen;
+
+  /* Find the longest covering node, n itself is new and not in the trie */
+  while (x && roa_covers(x, px, pxlen))
+    {
+      parent = x;
+      x = x->child[roa_bit(px, x->n.pxlen)];
+    }
+
+  n->parent = parent;
+  if (!x)
+    {
+      *roa_link(t, n) = n;
+      return;
+    }
+
+  /* The subtrie x is in the way, either n covers it ... */
+  if (roa_covers(n, x->n.prefix, x->n.pxlen))
+    {
+      *roa_link(t, x) = n;
+      n->child[roa_bit(x->n.prefix, pxlen)] = x;
+      x->parent = n;
+      return;
+    }
+
+  /* ... or they have to be joined by a glue node */
+  int len = ipa_pxlen(px, x->n.prefix);
+  ip_addr gpx = ipa_and(px, ipa_mkmask(len));
+
+  g = fib_get(&t->fib, &gpx, len);
+  g->parent = parent;
+  *roa_link(t, x) = g;
+  g->child[roa_bit(px, len)] = n;
+  g->child[roa_bit(x->n.prefix, len)] = x;
+  n->parent = x->parent = g;
+}
+
+static inline int
+roa_node_removable(struct roa_node *n)
+{ return !n->items && !(n->child[0] && n->child[1]); }
+
+/* Remove an empty node and glue nodes which are no longer needed */
+static void
+roa_trie_remove(struct roa_table *t, struct roa_node *n)
+{
+  while (n && roa_node_removable(n))
+    {
+      struct roa_node *parent = n->parent;
+      struct roa_node *c = n->child[0] ? n->child[0] : n->child[1];
+
+      *roa_link(t, n) = c;
+      if (c)
+	c->parent = parent;
+
+      fib_delete(&t->fib, n);
+      n = parent;
+    }
+}
+
 /**
  * roa_add_item - add a ROA entry
  * @t: ROA table
@@ -42,10 +139,13 @@ src_match(struct roa_item *it, byte src)
 void
 roa_add_item(struct roa_table *t, ip_addr prefix, byte pxlen, byte maxlen, u32 asn, byte src)
 {
-  struct roa_node *n = fib_get(&t->fib, &prefix, pxlen);
+  struct roa_node *n = fib_find(&t->fib, &prefix, pxlen);
 
-  // if ((n->items == NULL) && (n->n.x0 != ROA_INVALID))
-  // t->cached_items--;
+  if (!n)
+    {
+      n = fib_get(&t->fib, &prefix, pxlen);
+      roa_trie_insert(t, n);
+    }
 
   struct roa_item *it;
   for (it = n->items; it; it = it->next)
@@ -58,6 +158,8 @@ roa_add_item(struct roa_table *t, ip_addr prefix, byte pxlen, byte maxlen, u32 a
   it->src = src;
   it->next = n->items;
   n->items = it;
+
+  roa_notify(t, prefix, pxlen);
 }
 
 /**
@@ -91,9 +193,10 @@ roa_delete_item(struct roa_table *t, ip_addr prefix, byte pxlen, byte maxlen, u3
 
   *itp = it->next;
   sl_free(roa_slab, it);
+  roa_notify(t, prefix, pxlen);
 
-  // if ((n->items == NULL) && (n->n.x0 != ROA_INVALID))
-  // t->cached_items++;
+  if (!n->items)
+    roa_trie_remove(t, n);
 }
 
 
@@ -111,10 +214,15 @@ roa_flush(struct roa_table *t, byte src)
 {
   struct roa_item *it, **itp;
   struct roa_node *n;
+  struct fib_iterator fit;
+  int removed;
 
-  FIB_WALK(&t->fib, fn)
+  FIB_ITERATE_INIT(&fit, &t->fib);
+again:
+  FIB_ITERATE_START(&t->fib, &fit, fn)
     {
       n = (struct roa_node *) fn;
+      removed = 0;
 
       itp = &n->items;
       while (it = *itp)
@@ -122,47 +230,24 @@ roa_flush(struct roa_table *t, byte src)
 	  {
 	    *itp = it->next;
 	    sl_free(roa_slab, it);
+	    removed = 1;
 	  }
 	else
 	  itp = &it->next;
-    }
-  FIB_WALK_END;
-
-  // TODO add cleanup of roa_nodes
-}
 
+      if (removed)
+	roa_notify(t, n->n.prefix, n->n.pxlen);
 
-
-/*
-byte
-roa_check(struct roa_table *t, ip_addr prefix, byte pxlen, u32 asn)
-{
-  struct roa_node *n = fib_find(&t->fib, &prefix, pxlen);
-
-  if (n && n->n.x0 == ROA_UNKNOWN)
-    return ROA_UNKNOWN;
-
-  if (n && n->n.x0 == ROA_VALID && asn == n->cached_asn)
-    return ROA_VALID;
-
-  byte rv = roa_match(t, n, prefix, pxlen, asn);
-
-  if (rv != ROA_INVALID)
-    {
-      if (!n)
+      if (roa_node_removable(n))
 	{
-	  if (t->cached_items >= t->cached_items_max)
-	  n = fib_get(&t->fib, &prefix, pxlen);
-	  t->cached_items++;
+	  FIB_ITERATE_PUT(&fit, fn);
+	  roa_trie_remove(t, n);
+	  goto again;
 	}
-
-      n->cached_asn = asn;
-      n->n.x0 = rv;
     }
-
-  return rv;
+  FIB_ITERATE_END(fn);
 }
-*/
+
 
 /**
  * roa_check - check validity of route origination in a ROA table 
@@ -179,23 +264,18 @@ roa_check(struct roa_table *t, ip_addr prefix, byte pxlen, u32 asn)
  * length, return ROA_VALID. Otherwise return ROA_INVALID. If caller
  * cannot determine origin AS, 0 could be used (in that case ROA_VALID
  * cannot happen).
+ *
+ * All candidate ROAs are found during one descent of the ROA trie
+ * from its root towards the given prefix.
  */
 byte
 roa_check(struct roa_table *t, ip_addr prefix, byte pxlen, u32 asn)
 {
-  struct roa_node *n;
-  ip_addr px;
+  struct roa_node *n = t->root;
   byte anything = 0;
 
-  int len;
-  for (len = pxlen; len >= 0; len--)
+  while (n && roa_covers(n, prefix, pxlen))
     {
-      px = ipa_and(prefix, ipa_mkmask(len));
-      n = fib_find(&t->fib, &px, len);
-
-      if (!n)
-	continue;
-
       struct roa_item *it;
       for (it = n->items; it; it = it->next)
 	{
@@ -203,6 +283,11 @@ roa_check(struct roa_table *t, ip_addr prefix, byte pxlen, u32 asn)
 	  if ((it->maxlen >= pxlen) && (it->asn == asn) && asn)
 	    return ROA_VALID;
 	}
+
+      if (n->n.pxlen == pxlen)
+	break;
+
+      n = n->child[roa_bit(prefix, n->n.pxlen)];
     }
 
   return anything ? ROA_INVALID : ROA_UNKNOWN;
@@ -213,6 +298,46 @@ roa_node_init(struct fib_node *fn)
 {
   struct roa_node *n = (struct roa_node *) fn;
   n->items = NULL;
+  n->parent = n->child[0] = n->child[1] = NULL;
+}
+
+/**
+ * roa_new_set - create a prefix set
+ *
+ * Prefix sets are bare ROA tables not bound to any configuration,
+ * holding a dummy ROA entry for each prefix in the set. They are used
+ * by routing tables to collect changed ROA prefixes, as roa_check()
+ * finds out whether a network is covered by a prefix of the set in
+ * one trie descent. See roa_set_add() and roa_set_covers().
+ */
+struct roa_table *
+roa_new_set(void)
+{
+  struct roa_table *s = mb_allocz(roa_pool, sizeof(struct roa_table));
+  fib_init(&s->fib, roa_pool, sizeof(struct roa_node), 0, roa_node_init);
+  return s;
+}
+
+/**
+ * roa_free_set - free a prefix set
+ * @s: prefix set created by roa_new_set()
+ */
+void
+roa_free_set(struct roa_table *s)
+{
+  FIB_WALK(&s->fib, fn)
+    {
+      struct roa_item *it, *next;
+      for (it = ((struct roa_node *) fn)->items; it; it = next)
+	{
+	  next = it->next;
+	  sl_free(roa_slab, it);
+	}
+    }
+  FIB_WALK_END;
+
+  fib_free(&s->fib);
+  mb_free(s);
 }
 
 static inline void
@@ -223,6 +348,44 @@ roa_populate(struct roa_table *t)
     roa_add_item(t, ric->prefix, ric->pxlen, ric->maxlen, ric->asn, ROA_SRC_CONFIG);
 }
 
+static int
+roa_has_item(struct roa_table *t, struct roa_item_config *ric)
+{
+  struct roa_node *n = fib_find(&t->fib, &ric->prefix, ric->pxlen);
+  struct roa_item *it;
+
+  for (it = n ? n->items : NULL; it; it = it->next)
+    if ((it->maxlen == ric->maxlen) && (it->asn == ric->asn))
+      return 1;
+
+  return 0;
+}
+
+/*
+ * Replace configured ROA entries of the table by the ones from the new
+ * configuration @cf. Only entries which really differ are removed or
+ * added, so routing tables are not asked to revalidate routes covered
+ * by unchanged entries.
+ */
+static void
+roa_reconfigure(struct roa_table *t, struct roa_table_config *cf)
+{
+  struct roa_item_config *ric;
+  struct roa_table *s = roa_new_set();
+
+  for (ric = cf->roa_items; ric; ric = ric->next)
+    roa_add_item(s, ric->prefix, ric->pxlen, ric->maxlen, ric->asn, ROA_SRC_CONFIG);
+
+  for (ric = t->cf->roa_items; ric; ric = ric->next)
+    if (!roa_has_item(s, ric))
+      roa_delete_item(t, ric->prefix, ric->pxlen, ric->maxlen, ric->asn, ROA_SRC_CONFIG);
+
+  roa_free_set(s);
+
+  t->cf = cf;
+  roa_populate(t);
+}
+
 static void
 roa_new_table(struct roa_table_config *cf)
 {
@@ -318,11 +481,9 @@ roa_commit(struct config *new, struct config *old)
 	    cf = sym->def;
 	    cf->table = t;
 	    t->name = cf->name;
-	    t->cf = cf;
 
 	    /* Reconfigure it */
-	    roa_flush(t, ROA_SRC_CONFIG);
-	    roa_populate(t);
+	    roa_reconfigure(t, cf);
 	  }
 	else
 	  {
@@ -399,8 +560,6 @@ void
 roa_show(struct roa_show_data *d)
 {
   struct roa_node *rn;
-  ip_addr px;
-  int len;
 
   switch (d->mode)
     {
@@ -414,7 +573,7 @@ roa_show(struct roa_show_data *d)
 
     case ROA_SHOW_PX:
       rn = fib_find(&d->table->fib, &d->prefix, d->pxlen);
-      if (rn)
+      if (rn && rn->items)
 	{
 	  roa_show_node(this_cli, rn, 0, d->asn);
 	  cli_msg(0, "");
@@ -424,15 +583,14 @@ roa_show(struct roa_show_data *d)
       break;
 
     case ROA_SHOW_FOR:
-      for (len = d->pxlen; len >= 0; len--)
+      for (rn = d->table->root; rn && roa_covers(rn, d->prefix, d->pxlen); )
 	{
-	  px = ipa_and(d->prefix, ipa_mkmask(len));
-	  rn = fib_find(&d->table->fib, &px, len);
+	  roa_show_node(this_cli, rn, 0, d->asn);
 
-	  if (!rn)
-	    continue;
+	  if (rn->n.pxlen == d->pxlen)
+	    break;
 
-	  roa_show_node(this_cli, rn, 0, d->asn);
+	  rn = rn->child[roa_bit(d->prefix, rn->n.pxlen)];
 	}
       cli_msg(0, "");
       break;
@@ -26,6 +26,24 @@
  * (see the route attribute module for a precise explanation) holding the
  * remaining route attributes which are expected to be shared by multiple
  * routes in order to conserve memory.
+ *
+ * Routes with recursive next hops refer to a &hostentry in the hostcache
+ * of their IGP table. Each table keeps track of its nets containing
+ * such routes (&hostdep, linked to the list of the hostentry), so when
+ * the IGP route of a hostentry changes, the Next Hop Update visits just
+ * the nets depending on that hostentry instead of the whole table.
+ *
+ * Hostentries themselves are indexed by the prefix of the IGP route
+ * they are resolved through (&hc_prefix). A change of an IGP net marks
+ * for resolution only the hostentries resolved through that net or
+ * through a less specific one covering them, and the trie used to
+ * filter irrelevant changes is extended as hostentries move, being
+ * rebuilt only when it contains too many obsolete ranges.
+ *
+ * When ROA entries change, tables with protocols using roa_check() on
+ * the changed ROA table in their import filters collect the changed
+ * prefixes and, from the table event, run the import filters again on
+ * routes covered by them.
  */
 
 #undef LOCAL_DEBUG
@@ -37,12 +55,32 @@
 #include "nest/iface.h"
 #include "lib/resource.h"
 #include "lib/event.h"
+#include "lib/perf.h"
 #include "lib/string.h"
 #include "conf/conf.h"
 #include "filter/filter.h"
 #include "lib/string.h"
 #include "lib/alloca.h"
 
+struct hostdep {
+  node n;				/* Node in hostentry->deps */
+  struct hostdep *next;			/* Next in hash chain */
+  struct hostentry *he;
+  net *net;
+};
+
+struct hc_prefix {
+  struct fib_node n;
+  list hostentries;			/* Hostentries resolved through this prefix (pxn) */
+};
+
+struct hostdeps {
+  slab *slab;				/* Slab holding all hostdeps */
+  struct hostdep **hash_table;		/* Hash table indexed by (hostentry, net) */
+  unsigned hash_order;
+  unsigned hash_items;
+};
+
 pool *rt_table_pool;
 
 static slab *rte_slab;
@@ -55,6 +93,8 @@ static void rt_free_hostcache(rtable *tab);
 static void rt_notify_hostcache(rtable *tab, net *net);
 static void rt_update_hostcache(rtable *tab);
 static void rt_next_hop_update(rtable *tab);
+static void rt_update_hostdeps(rtable *tab, net *n, rte *new, rte *old);
+static void rt_free_hostdeps(rtable *tab);
 
 static inline void rt_schedule_gc(rtable *tab);
 
@@ -250,6 +290,7 @@ do_rt_notify(struct announce_hook *ah, net *net, rte *new, rte *old, ea_list *tm
   struct proto *p = ah->proto;
   struct proto_stats *stats = ah->stats;
 
+  p->perf.routes_out++;
 
   /*
    * First, apply export limit.
@@ -784,6 +825,8 @@ rte_recalculate(struct announce_hook *ah, net *net, rte *new, ea_list *tmpa, str
   if (new)
     new->lastmod = now;
 
+  rt_update_hostdeps(table, net, new, old);
+
   /* Log the route change */
   if (new)
     rte_trace_in(D_ROUTES, p, new, net->routes == new ? "added [best]" : "added");
@@ -838,6 +881,43 @@ rte_update_unlock(void)
     lp_flush(rte_update_pool);
 }
 
+static inline int
+rt_hook_uses_roa(struct announce_hook *ah)
+{
+  struct filter *f = ah->in_filter;
+  return (f != FILTER_ACCEPT) && (f != FILTER_REJECT) && f->roa_tables;
+}
+
+static inline int
+rt_hook_modifies(struct announce_hook *ah)
+{
+  struct filter *f = ah->in_filter;
+  return (f != FILTER_ACCEPT) && (f != FILTER_REJECT) && f->modifies;
+}
+
+/*
+ * Routes rejected by import filters using ROA are not stored, but their
+ * prefixes are, so the protocol may be asked to send them again when the
+ * ROA tables change. See rt_reload_rejected().
+ */
+static inline void
+rt_note_rejected(struct announce_hook *ah, net *n)
+{
+  if (!rt_hook_uses_roa(ah))
+    return;
+
+  if (!ah->roa_rejected)
+    ah->roa_rejected = roa_new_set();
+  roa_set_add(ah->roa_rejected, n->n.prefix, n->n.pxlen);
+}
+
+static inline void
+rt_note_accepted(struct announce_hook *ah, net *n)
+{
+  if (ah->roa_rejected)
+    roa_set_del(ah->roa_rejected, n->n.prefix, n->n.pxlen);
+}
+
 /**
  * rte_update - enter a new update to a routing table
  * @table: table to be updated
@@ -888,6 +968,7 @@ rte_update2(struct announce_hook *ah, net *net, rte *new, struct proto *src)
   struct filter *filter = ah->in_filter;
   ea_list *tmpa = NULL;
 
+  p->perf.routes_in++;
   rte_update_lock();
   if (new)
     {
@@ -916,6 +997,7 @@ rte_update2(struct announce_hook *ah, net *net, rte *new, struct proto *src)
 	    {
 	      stats->imp_updates_filtered++;
 	      rte_trace_in(D_FILTERS, p, new, "filtered out");
+	      rt_note_rejected(ah, net);
 	      goto drop;
 	    }
 	  if (tmpa != old_tmpa && src->store_tmp_attrs)
@@ -928,6 +1010,7 @@ rte_update2(struct announce_hook *ah, net *net, rte *new, struct proto *src)
   else
     stats->imp_withdraws_received++;
 
+  rt_note_accepted(ah, net);
   rte_recalculate(ah, net, new, tmpa, src);
   rte_update_unlock();
   return;
@@ -1005,9 +1088,46 @@ rt_dump(rtable *t)
   FIB_WALK_END;
   WALK_LIST(a, t->hooks)
     debug("\tAnnounces routes to protocol %s\n", a->proto->name);
+  debug("\tNext hop updates: %u, last visited %u nets, updated %u routes in %u us\n",
+	t->nhu_stats.runs, t->nhu_stats.nets, t->nhu_stats.routes, (unsigned) t->nhu_stats.time);
   debug("\n");
 }
 
+/**
+ * rt_show_perf - show Next Hop Update statistics
+ *
+ * This function is a part of the |show perf| command. For each routing
+ * table, it prints the number of finished Next Hop Updates and how many
+ * nets and routes the last one has touched and how long it took.
+ */
+void
+rt_show_perf(void)
+{
+  rtable *t;
+
+  cli_msg(-2023, "%-16s %12s %12s %12s %12s", "Next hop update", "Runs", "Last nets", "Last routes", "Last us");
+  WALK_LIST(t, routing_tables)
+    cli_msg(-1023, "%-16s %12u %12u %12u %12lu", t->name, t->nhu_stats.runs,
+	    t->nhu_stats.nets, t->nhu_stats.routes, (unsigned long) t->nhu_stats.time);
+}
+
+/**
+ * rt_reset_perf - clear Next Hop Update statistics of all tables
+ *
+ * Statistics of a Next Hop Update just running are kept.
+ */
+void
+rt_reset_perf(void)
+{
+  rtable *t;
+
+  WALK_LIST(t, routing_tables)
+    {
+      t->nhu_stats.runs = t->nhu_stats.nets = t->nhu_stats.routes = 0;
+      t->nhu_stats.time = 0;
+    }
+}
+
 /**
  * rt_dump_all - dump all routing tables
  *
@@ -1043,13 +1163,24 @@ rt_schedule_hcu(rtable *tab)
 }
 
 static inline void
-rt_schedule_nhu(rtable *tab)
+rt_schedule_nhu(struct hostentry *he)
 {
-  if (tab->nhu_state == 0)
+  rtable *tab = he->tab;
+
+  if (EMPTY_LIST(he->deps))
+    return;
+
+  if (EMPTY_LIST(tab->nhu_list))
     ev_schedule(tab->rt_event);
 
-  /* state change 0->1, 2->3 */
-  tab->nhu_state |= 1;
+  if (!he->nhu_pending)
+    {
+      add_tail(&tab->nhu_list, &he->nhu_n);
+      he->nhu_pending = 1;
+    }
+
+  /* (Re)start from the first dependent net */
+  he->nhu_pos = HEAD(he->deps);
 }
 
 static void
@@ -1084,6 +1215,241 @@ again:
   tab->gc_scheduled = 0;
 }
 
+/**
+ * rt_roa_changed - note a change of ROA entries
+ * @t: ROA table
+ * @prefix: prefix of the changed ROA entries
+ * @pxlen: prefix length
+ *
+ * This function is called by the ROA table module whenever ROA entries
+ * for the given prefix are added to or removed from the ROA table @t.
+ * Routes covered by the prefix may change their validity, so each
+ * routing table imported to by a protocol calling roa_check() on @t in
+ * its import filter remembers the prefix and schedules revalidation of
+ * the affected routes.
+ */
+void
+rt_roa_changed(struct roa_table *t, ip_addr prefix, int pxlen)
+{
+  struct announce_hook *ah;
+  struct proto *p;
+  rtable *tab;
+
+  WALK_LIST(p, active_proto_list)
+    for (ah = p->ahooks; ah; ah = ah->next)
+      if (f_uses_roa_table(ah->in_filter, t))
+	{
+	  ah->roa_changed = 1;
+	  tab = ah->table;
+	  if (!tab->roa_changed)
+	    tab->roa_changed = roa_new_set();
+	  roa_set_add(tab->roa_changed, prefix, pxlen);
+	  ev_schedule(tab->rt_event);
+	}
+}
+
+/*
+ * Run the import filter again on a route in the table. The original
+ * route as received by the protocol is not kept, so the filter gets
+ * the route as it was accepted before. Therefore this is done only for
+ * filters which do not change route attributes, other routes are
+ * reloaded by the protocol. A route rejected now is withdrawn, a route
+ * modified by the filter is replaced.
+ */
+static void
+rt_revalidate_rte(struct announce_hook *ah, net *n, rte *old)
+{
+  struct proto *p = ah->proto;
+  struct proto *src = old->attrs->proto;
+  ea_list *tmpa = NULL, *old_tmpa;
+  rte *new = old;
+  int fr;
+
+  rte_update_lock();
+  if (src->make_tmp_attrs)
+    tmpa = src->make_tmp_attrs(old, rte_update_pool);
+  old_tmpa = tmpa;
+
+  fr = f_run(ah->in_filter, &new, &tmpa, rte_update_pool, 0);
+  if (fr > F_ACCEPT)
+    {
+      ah->stats->imp_updates_filtered++;
+      rte_trace_in(D_FILTERS, p, old, "filtered out [revalidated]");
+      if (new != old)
+	rte_free(new);
+      rt_note_rejected(ah, n);
+      rte_recalculate(ah, n, NULL, NULL, src);
+    }
+  else if ((new != old) || (tmpa != old_tmpa))
+    {
+      if (tmpa != old_tmpa && src->store_tmp_attrs)
+	{
+	  new = rte_cow(new);
+	  src->store_tmp_attrs(new, tmpa);
+	}
+      if (!(new->attrs->aflags & RTAF_CACHED))
+	new->attrs = rta_lookup(new->attrs);
+      new->flags |= REF_COW;
+      rte_recalculate(ah, n, new, tmpa, src);
+    }
+  rte_update_unlock();
+}
+
+/* Revalidate routes of one net, returns the number of routes visited */
+static int
+rt_revalidate_net(net *n)
+{
+  struct announce_hook **hooks;
+  int cnt = 0, i;
+  rte *e;
+
+  for (e = n->routes; e; e = e->next)
+    if (e->sender->roa_reval)
+      {
+	/* Running the filter again would apply its changes twice */
+	if (rt_hook_modifies(e->sender))
+	  e->sender->roa_reload = 1;
+	else
+	  cnt++;
+      }
+
+  if (!cnt)
+    return 0;
+
+  /* Each hook has at most one route for the net, but the route list changes */
+  hooks = alloca(cnt * sizeof(struct announce_hook *));
+  for (i = 0, e = n->routes; e; e = e->next)
+    if (e->sender->roa_reval && !rt_hook_modifies(e->sender))
+      hooks[i++] = e->sender;
+
+  for (i = 0; i < cnt; i++)
+    for (e = n->routes; e; e = e->next)
+      if (e->sender == hooks[i])
+	{
+	  rt_revalidate_rte(hooks[i], n, e);
+	  break;
+	}
+
+  return cnt;
+}
+
+/*
+ * Start revalidation in hooks affected by the changes being handled.
+ * Routes rejected earlier may be accepted now. As we do not have them,
+ * protocols which rejected routes in the changed prefixes of the ROA
+ * tables they use are asked to send their routes again at the end of
+ * the walk, see rt_reload_changed().
+ */
+static void
+rt_reval_start(rtable *tab)
+{
+  struct announce_hook *ah;
+  struct proto *p;
+
+  WALK_LIST(p, active_proto_list)
+    for (ah = p->ahooks; ah; ah = ah->next)
+      if ((ah->table == tab) && ah->roa_changed)
+	{
+	  ah->roa_changed = 0;
+	  ah->roa_reval = 1;
+	  if (!ah->roa_rejected)
+	    continue;
+
+	  FIB_WALK(&ah->roa_rejected->fib, fn)
+	    {
+	      if (((struct roa_node *) fn)->items &&
+		  roa_set_covers(tab->roa_reval, fn->prefix, fn->pxlen))
+		ah->roa_reload = 1;
+	    }
+	  FIB_WALK_END;
+	}
+}
+
+/*
+ * Finish revalidation and reload routes of hooks which had rejected
+ * routes or routes imported through filters changing attributes in the
+ * changed prefixes. Protocols unable to reload keep such routes as they
+ * are until they are reloaded or restarted.
+ */
+static void
+rt_reload_changed(rtable *tab)
+{
+  struct announce_hook *ah;
+  struct proto *p;
+
+  WALK_LIST(p, active_proto_list)
+    for (ah = p->ahooks; ah; ah = ah->next)
+      if ((ah->table == tab) && ah->roa_reval)
+	{
+	  ah->roa_reval = 0;
+	  if (!ah->roa_reload)
+	    continue;
+
+	  ah->roa_reload = 0;
+	  if (p->proto_state != PS_UP)
+	    continue;
+
+	  if (!p->reload_routes)
+	    {
+	      log(L_WARN "Protocol %s cannot reload routes, ROA change not applied to them", p->name);
+	      continue;
+	    }
+
+	  log(L_INFO "Reloading protocol %s due to ROA change", p->name);
+	  if (ah->roa_rejected)
+	    {
+	      roa_free_set(ah->roa_rejected);
+	      ah->roa_rejected = NULL;
+	    }
+	  p->reload_routes(p);
+	}
+}
+
+/*
+ * Walk the table and revalidate routes in nets covered by changed ROA
+ * prefixes. Changes noted during the walk are collected separately and
+ * handled by the next walk. The walk is split into multiple events, so
+ * a bulk update of ROA tables does not block other work.
+ */
+static void
+rt_revalidate(rtable *tab)
+{
+  struct fib_iterator *fit = &tab->reval_fit;
+  int max_nets = 4096;
+  int max_routes = 256;
+
+  if (!tab->roa_reval)
+    {
+      tab->roa_reval = tab->roa_changed;
+      tab->roa_changed = NULL;
+      FIB_ITERATE_INIT(fit, &tab->fib);
+      rt_reval_start(tab);
+    }
+
+  FIB_ITERATE_START(&tab->fib, fit, fn)
+    {
+      net *n = (net *) fn;
+
+      if ((max_nets-- <= 0) || (max_routes <= 0))
+	{
+	  FIB_ITERATE_PUT(fit, fn);
+	  ev_schedule(tab->rt_event);
+	  return;
+	}
+
+      if (n->routes && roa_set_covers(tab->roa_reval, n->n.prefix, n->n.pxlen))
+	max_routes -= rt_revalidate_net(n);
+    }
+  FIB_ITERATE_END(fn);
+
+  rt_reload_changed(tab);
+  roa_free_set(tab->roa_reval);
+  tab->roa_reval = NULL;
+
+  if (tab->roa_changed)
+    ev_schedule(tab->rt_event);
+}
+
 static void
 rt_event(void *ptr)
 {
@@ -1092,9 +1458,12 @@ rt_event(void *ptr)
   if (tab->hcu_scheduled)
     rt_update_hostcache(tab);
 
-  if (tab->nhu_state)
+  if (!EMPTY_LIST(tab->nhu_list))
     rt_next_hop_update(tab);
 
+  if (tab->roa_changed || tab->roa_reval)
+    rt_revalidate(tab);
+
   if (tab->gc_scheduled)
     rt_prune_nets(tab);
 }
@@ -1107,6 +1476,7 @@ rt_setup(pool *p, rtable *t, char *name, struct rtable_config *cf)
   t->name = name;
   t->config = cf;
   init_list(&t->hooks);
+  init_list(&t->nhu_list);
   if (cf)
     {
       t->rt_event = ev_new(p);
@@ -1216,12 +1586,18 @@ rt_prune_loop(void)
 {
   rtable *t;
   int max_feed = 512;
+  u64 start = perf_start();
+  int done = 1;
 
   WALK_LIST(t, routing_tables)
     if (! rt_prune_step(t, &max_feed))
-      return 0;
+      {
+	done = 0;
+	break;
+      }
 
-  return 1;
+  perf_end(PERF_PRUNE, start);
+  return done;
 }
 
 void
@@ -1351,35 +1727,43 @@ rt_next_hop_update_net(rtable *tab, net *n)
 static void
 rt_next_hop_update(rtable *tab)
 {
-  struct fib_iterator *fit = &tab->nhu_fit;
+  struct nhu_stats *s = &tab->nhu_stats;
+  u64 start = current_time_usec();
   int max_feed = 32;
+  node *n, *nx;
 
-  if (tab->nhu_state == 0)
-    return;
-
-  if (tab->nhu_state == 1)
+  WALK_LIST_DELSAFE(n, nx, tab->nhu_list)
     {
-      FIB_ITERATE_INIT(fit, &tab->fib);
-      tab->nhu_state = 2;
-    }
+      struct hostentry *he = SKIP_BACK(struct hostentry, nhu_n, n);
 
-  FIB_ITERATE_START(&tab->fib, fit, fn)
-    {
-      if (max_feed <= 0)
+      while (NODE_VALID(he->nhu_pos))
 	{
-	  FIB_ITERATE_PUT(fit, fn);
-	  ev_schedule(tab->rt_event);
-	  return;
+	  if (max_feed <= 0)
+	    {
+	      s->cur_time += current_time_usec() - start;
+	      ev_schedule(tab->rt_event);
+	      return;
+	    }
+
+	  struct hostdep *d = SKIP_BACK(struct hostdep, n, he->nhu_pos);
+	  he->nhu_pos = he->nhu_pos->next;
+
+	  int count = rt_next_hop_update_net(tab, d->net);
+	  max_feed -= count;
+	  s->cur_nets++;
+	  s->cur_routes += count;
 	}
-      max_feed -= rt_next_hop_update_net(tab, (net *) fn);
-    }
-  FIB_ITERATE_END(fn);
 
-  /* state change 2->0, 3->1 */
-  tab->nhu_state &= 1;
+      rem_node(&he->nhu_n);
+      he->nhu_pending = 0;
+    }
 
-  if (tab->nhu_state > 0)
-    ev_schedule(tab->rt_event);
+  s->runs++;
+  s->nets = s->cur_nets;
+  s->routes = s->cur_routes;
+  s->time = s->cur_time + current_time_usec() - start;
+  s->cur_nets = s->cur_routes = 0;
+  s->cur_time = 0;
 }
 
 
@@ -1427,6 +1811,12 @@ rt_unlock_table(rtable *r)
       DBG("Deleting routing table %s\n", r->name);
       if (r->hostcache)
 	rt_free_hostcache(r);
+      if (r->hostdeps)
+	rt_free_hostdeps(r);
+      if (r->roa_changed)
+	roa_free_set(r->roa_changed);
+      if (r->roa_reval)
+	roa_free_set(r->roa_reval);
       rem_node(&r->n);
       fib_free(&r->fib);
       rfree(r->rt_event);
@@ -1672,6 +2062,63 @@ hc_resize(struct hostcache *hc, unsigned new_order)
   mb_free(old_table);
 }
 
+static void
+hc_prefix_init(struct fib_node *N)
+{
+  struct hc_prefix *px = (struct hc_prefix *) N;
+  init_list(&px->hostentries);
+}
+
+static void
+hc_unlink_prefix(struct hostcache *hc, struct hostentry *he)
+{
+  struct hc_prefix *px = he->px;
+
+  if (!px)
+    return;
+
+  rem_node(&he->pxn);
+  he->px = NULL;
+  hc->trie_stale++;
+
+  if (EMPTY_LIST(px->hostentries))
+    {
+      hc->px_count[px->n.pxlen]--;
+      fib_delete(&hc->prefixes, px);
+    }
+}
+
+static void
+hc_link_prefix(struct hostcache *hc, struct hostentry *he, int pxlen)
+{
+  ip_addr prefix = ipa_and(he->addr, ipa_mkmask(pxlen));
+  struct hc_prefix *px = he->px;
+
+  if (px && (px->n.pxlen == pxlen) && ipa_equal(px->n.prefix, prefix))
+    return;
+
+  hc_unlink_prefix(hc, he);
+
+  px = fib_get(&hc->prefixes, &prefix, pxlen);
+  if (EMPTY_LIST(px->hostentries))
+    hc->px_count[pxlen]++;
+  add_tail(&px->hostentries, &he->pxn);
+  he->px = px;
+
+  /* Add a prefix range to the trie */
+  trie_add_prefix(hc->trie, he->addr, MAX_PREFIX_LENGTH, pxlen, MAX_PREFIX_LENGTH);
+}
+
+static inline void
+hc_schedule_update(struct hostcache *hc, struct hostentry *he)
+{
+  if (he->update_pending)
+    return;
+
+  add_tail(&hc->updates, &he->un);
+  he->update_pending = 1;
+}
+
 static struct hostentry *
 hc_new_hostentry(struct hostcache *hc, ip_addr a, ip_addr ll, rtable *dep, unsigned k)
 {
@@ -1683,11 +2130,16 @@ hc_new_hostentry(struct hostcache *hc, ip_addr a, ip_addr ll, rtable *dep, unsig
   he->hash_key = k;
   he->uc = 0;
   he->src = NULL;
+  he->nhu_pending = 0;
+  init_list(&he->deps);
+  he->px = NULL;
+  he->update_pending = 0;
 
   add_tail(&hc->hostentries, &he->ln);
   hc_insert(hc, he);
 
   hc->hash_items++;
+  hc->new_items++;
   if (hc->hash_items > hc->hash_max)
     hc_resize(hc, hc->hash_order + HC_HI_STEP);
 
@@ -1699,6 +2151,13 @@ hc_delete_hostentry(struct hostcache *hc, struct hostentry *he)
 {
   rta_free(he->src);
 
+  if (he->nhu_pending)
+    rem_node(&he->nhu_n);
+
+  if (he->update_pending)
+    rem_node(&he->un);
+
+  hc_unlink_prefix(hc, he);
   rem_node(&he->ln);
   hc_remove(hc, he);
   sl_free(hc->slab, he);
@@ -1713,6 +2172,8 @@ rt_init_hostcache(rtable *tab)
 {
   struct hostcache *hc = mb_allocz(rt_table_pool, sizeof(struct hostcache));
   init_list(&hc->hostentries);
+  init_list(&hc->updates);
+  fib_init(&hc->prefixes, rt_table_pool, sizeof(struct hc_prefix), 0, hc_prefix_init);
 
   hc->hash_items = 0;
   hc_alloc_table(hc, HC_DEF_ORDER);
@@ -1741,6 +2202,7 @@ rt_free_hostcache(rtable *tab)
 
   rfree(hc->slab);
   rfree(hc->lp);
+  fib_free(&hc->prefixes);
   mb_free(hc->hash_table);
   mb_free(hc);
 }
@@ -1749,11 +2211,40 @@ static void
 rt_notify_hostcache(rtable *tab, net *net)
 {
   struct hostcache *hc = tab->hostcache;
+  ip_addr prefix = net->n.prefix;
+  int pxlen = net->n.pxlen;
+  int marked = 0;
+  int l;
 
-  if (tab->hcu_scheduled)
+  if (!trie_match_prefix(hc->trie, prefix, pxlen))
     return;
 
-  if (trie_match_prefix(hc->trie, net->n.prefix, net->n.pxlen))
+  /*
+   * Affected are hostentries resolved through this net and those resolved
+   * through a less specific net, but covered by this one.
+   */
+  for (l = 0; l <= pxlen; l++)
+    if (hc->px_count[l])
+      {
+	ip_addr a = ipa_and(prefix, ipa_mkmask(l));
+	struct hc_prefix *px = fib_find(&hc->prefixes, &a, l);
+	node *n;
+
+	if (!px)
+	  continue;
+
+	WALK_LIST(n, px->hostentries)
+	  {
+	    struct hostentry *he = SKIP_BACK(struct hostentry, pxn, n);
+	    if ((l == pxlen) || ipa_in_net(he->addr, prefix, pxlen))
+	      {
+		hc_schedule_update(hc, he);
+		marked = 1;
+	      }
+	  }
+      }
+
+  if (marked)
     rt_schedule_hcu(tab);
 }
 
@@ -1850,27 +2341,57 @@ rt_update_hostentry(rtable *tab, struct hostentry *he)
     }
 
  done:
-  /* Add a prefix range to the trie */
-  trie_add_prefix(tab->hostcache->trie, he->addr, MAX_PREFIX_LENGTH, pxlen, MAX_PREFIX_LENGTH);
+  hc_link_prefix(tab->hostcache, he, pxlen);
 
   rta_free(old_src);
   return old_src != he->src;
 }
 
 static void
-rt_update_hostcache(rtable *tab)
+rt_rebuild_hostcache_trie(struct hostcache *hc)
 {
-  struct hostcache *hc = tab->hostcache;
   struct hostentry *he;
-  node *n, *x;
+  node *n;
 
-  /* Reset the trie */
   lp_flush(hc->lp);
   hc->trie = f_new_trie(hc->lp);
 
-  WALK_LIST_DELSAFE(n, x, hc->hostentries)
+  WALK_LIST(n, hc->hostentries)
     {
       he = SKIP_BACK(struct hostentry, ln, n);
+      trie_add_prefix(hc->trie, he->addr, MAX_PREFIX_LENGTH, he->px->n.pxlen, MAX_PREFIX_LENGTH);
+    }
+
+  trie_compile(hc->trie);
+  hc->trie_stale = 0;
+}
+
+static void
+rt_update_hostcache(rtable *tab)
+{
+  struct hostcache *hc = tab->hostcache;
+  struct hostentry *he;
+  node *n, *x;
+
+  /* Remove unused hostentries, once enough new ones were created */
+  if (hc->new_items > hc->hash_items / 2)
+    {
+      WALK_LIST_DELSAFE(n, x, hc->hostentries)
+	{
+	  he = SKIP_BACK(struct hostentry, ln, n);
+	  if (!he->uc)
+	    hc_delete_hostentry(hc, he);
+	}
+      hc->new_items = 0;
+    }
+
+  /* Resolve again just the hostentries affected by changed nets */
+  WALK_LIST_DELSAFE(n, x, hc->updates)
+    {
+      he = SKIP_BACK(struct hostentry, un, n);
+      rem_node(&he->un);
+      he->update_pending = 0;
+
       if (!he->uc)
 	{
 	  hc_delete_hostentry(hc, he);
@@ -1878,12 +2399,157 @@ rt_update_hostcache(rtable *tab)
 	}
 
       if (rt_update_hostentry(tab, he))
-	rt_schedule_nhu(he->tab);
+	rt_schedule_nhu(he);
     }
 
+  if (hc->trie_stale > hc->hash_items)
+    rt_rebuild_hostcache_trie(hc);
+
   tab->hcu_scheduled = 0;
 }
 
+
+/*
+ *	Dependencies of nets on hostentries
+ */
+
+#define HD_DEF_ORDER 10
+#define HD_HI_MARK *4
+#define HD_HI_STEP 2
+#define HD_HI_ORDER 24
+#define HD_LO_MARK /5
+#define HD_LO_STEP 2
+
+static inline unsigned
+hd_hash(struct hostdeps *hd, struct hostentry *he, net *n)
+{
+  return ((ptr_hash(he) ^ ptr_hash(n)) * 2654435761U) >> (32 - hd->hash_order);
+}
+
+static void
+hd_resize(struct hostdeps *hd, unsigned new_order)
+{
+  unsigned old_size = 1 << hd->hash_order;
+  struct hostdep **old_table = hd->hash_table;
+  struct hostdep *d, *dn;
+  unsigned i, k;
+
+  hd->hash_order = new_order;
+  hd->hash_table = mb_allocz(rt_table_pool, (1 << new_order) * sizeof(struct hostdep *));
+
+  for (i = 0; i < old_size; i++)
+    for (d = old_table[i]; d; d = dn)
+      {
+	dn = d->next;
+	k = hd_hash(hd, d->he, d->net);
+	d->next = hd->hash_table[k];
+	hd->hash_table[k] = d;
+      }
+  mb_free(old_table);
+}
+
+static void
+rt_add_hostdep(rtable *tab, struct hostentry *he, net *n)
+{
+  struct hostdeps *hd = tab->hostdeps;
+
+  if (!hd)
+    {
+      hd = tab->hostdeps = mb_allocz(rt_table_pool, sizeof(struct hostdeps));
+      hd->slab = sl_new(rt_table_pool, sizeof(struct hostdep));
+      hd->hash_order = HD_DEF_ORDER;
+      hd->hash_table = mb_allocz(rt_table_pool, (1 << HD_DEF_ORDER) * sizeof(struct hostdep *));
+    }
+
+  struct hostdep *d = sl_alloc(hd->slab);
+  unsigned k = hd_hash(hd, he, n);
+  d->he = he;
+  d->net = n;
+  d->next = hd->hash_table[k];
+  hd->hash_table[k] = d;
+  add_tail(&he->deps, &d->n);
+
+  hd->hash_items++;
+  if ((hd->hash_items > (1U << hd->hash_order) HD_HI_MARK) && (hd->hash_order < HD_HI_ORDER))
+    hd_resize(hd, hd->hash_order + HD_HI_STEP);
+}
+
+static void
+rt_remove_hostdep(rtable *tab, struct hostentry *he, net *n)
+{
+  struct hostdeps *hd = tab->hostdeps;
+  struct hostdep *d, **dp;
+
+  for (dp = &hd->hash_table[hd_hash(hd, he, n)]; d = *dp; dp = &d->next)
+    if ((d->he == he) && (d->net == n))
+      break;
+
+  if (!d)
+    {
+      log(L_BUG "Missing hostentry dependency for %I/%d", n->n.prefix, n->n.pxlen);
+      return;
+    }
+
+  *dp = d->next;
+
+  /* Keep a running Next Hop Update valid */
+  if (he->nhu_pos == &d->n)
+    he->nhu_pos = d->n.next;
+
+  rem_node(&d->n);
+  sl_free(hd->slab, d);
+
+  hd->hash_items--;
+  if ((hd->hash_items < (1U << hd->hash_order) HD_LO_MARK) && (hd->hash_order > HD_DEF_ORDER))
+    hd_resize(hd, hd->hash_order - HD_LO_STEP);
+}
+
+static inline int
+rt_net_uses_hostentry(net *n, struct hostentry *he, rte *skip)
+{
+  rte *e;
+
+  for (e = n->routes; e; e = e->next)
+    if ((e != skip) && (e->attrs->hostentry == he))
+      return 1;
+
+  return 0;
+}
+
+/*
+ * Called by rte_recalculate() after @new replaced @old in @n. A net
+ * depends on a hostentry while at least one of its routes uses it.
+ */
+static void
+rt_update_hostdeps(rtable *tab, net *n, rte *new, rte *old)
+{
+  struct hostentry *nhe = new ? new->attrs->hostentry : NULL;
+  struct hostentry *ohe = old ? old->attrs->hostentry : NULL;
+
+  if (nhe == ohe)
+    return;
+
+  if (nhe && (nhe->tab == tab) && !rt_net_uses_hostentry(n, nhe, new))
+    rt_add_hostdep(tab, nhe, n);
+
+  if (ohe && (ohe->tab == tab) && !rt_net_uses_hostentry(n, ohe, NULL))
+    rt_remove_hostdep(tab, ohe, n);
+}
+
+static void
+rt_free_hostdeps(rtable *tab)
+{
+  struct hostdeps *hd = tab->hostdeps;
+
+  if (hd->hash_items)
+    log(L_ERR "Hostentry dependencies are not empty in table %s", tab->name);
+
+  rfree(hd->slab);
+  mb_free(hd->hash_table);
+  mb_free(hd);
+  tab->hostdeps = NULL;
+}
+
 static struct hostentry *
 rt_find_hostentry(rtable *tab, ip_addr a, ip_addr ll, rtable *dep)
 {
@@ -1967,6 +2633,154 @@ rt_show_rte(struct cli *c, byte *ia, rte *e, struct rt_show_data *d, ea_list *tm
     rta_show(c, a, tmpa);
 }
 
+/*
+ * Output of 'show route ... json' is intended for external tools
+ * pulling whole tables, so each route is written as one line with a
+ * JSON object directly to the CLI output buffer, avoiding the printf
+ * engine. Strings are escaped, the line length is bounded beforehand.
+ */
+
+static byte *
+rt_json_str(byte *p, char *s)
+{
+  static char hex[] = "0123456789abcdef";
+
+  *p++ = '"';
+  for (; *s; s++)
+    if ((*s == '"') || (*s == '\\'))
+      {
+	*p++ = '\\';
+	*p++ = *s;
+      }
+    else if ((byte) *s < 0x20)
+      {
+	memcpy(p, "\\u00", 4);
+	p[4] = hex[(byte) *s >> 4];
+	p[5] = hex[*s & 0xf];
+	p += 6;
+      }
+    else
+      *p++ = *s;
+  *p++ = '"';
+  return p;
+}
+
+static byte *
+rt_json_uint(byte *p, u32 v)
+{
+  byte buf[10];
+  int i = 0;
+
+  do
+    buf[i++] = '0' + v % 10;
+  while (v /= 10);
+
+  while (i)
+    *p++ = buf[--i];
+  return p;
+}
+
+static inline byte *
+rt_json_ip(byte *p, ip_addr a)
+{
+  *p++ = '"';
+  p = ip_ntop(a, p);
+  *p++ = '"';
+  return p;
+}
+
+/* Copy a literal part of the line */
+static inline byte *
+rt_json_raw(byte *p, char *key)
+{
+  int l = strlen(key);
+  memcpy(p, key, l);
+  return p + l;
+}
+
+#define RT_JSON_BASE	256			/* Line without strings of variable length */
+#define RT_JSON_NH	(STD_ADDRESS_P_LENGTH + 6*sizeof(((struct iface *) 0)->name) + 48)
+
+static void
+rt_show_rte_json(struct cli *c, rte *e)
+{
+  static char *dest_names[] = { "router", "device", "blackhole", "unreachable", "prohibited", "multipath" };
+  rta *a = e->attrs;
+  struct mpnh *nh;
+  int max, nhs;
+  byte *p, *p0;
+
+  /* Reserve just the space needed, as much of next hops as fits in a line */
+  max = RT_JSON_BASE + 6 * strlen(a->proto->name) + RT_JSON_NH;
+  for (nhs = 0, nh = a->nexthops; nh && (max + RT_JSON_NH <= CLI_MAX_LINE_TEXT); nh = nh->next)
+    max += RT_JSON_NH, nhs++;
+  if (max > CLI_MAX_LINE_TEXT)
+    {
+      cli_printf(c, -8000, "<line overflow>");
+      return;
+    }
+
+  p = p0 = cli_line_start(c, -1007, max);
+
+  p = rt_json_raw(p, "{\"net\":\"");
+  p = ip_ntop(e->net->n.prefix, p);
+  *p++ = '/';
+  p = rt_json_uint(p, e->net->n.pxlen);
+  *p++ = '"';
+  p = rt_json_raw(p, ",\"proto\":");
+  p = rt_json_str(p, a->proto->name);
+  p = rt_json_raw(p, ",\"source\":");
+  p = rt_json_str(p, rta_src_names[a->source]);
+  p = rt_json_raw(p, ",\"dest\":");
+  p = rt_json_str(p, (a->dest < RTD_NONE) ? dest_names[a->dest] : "none");
+
+  if (a->dest == RTD_ROUTER)
+    {
+      p = rt_json_raw(p, ",\"gw\":");
+      p = rt_json_ip(p, a->gw);
+    }
+  if (a->iface && (a->dest == RTD_ROUTER || a->dest == RTD_DEVICE))
+    {
+      p = rt_json_raw(p, ",\"iface\":");
+      p = rt_json_str(p, a->iface->name);
+    }
+  if (ipa_nonzero(a->from) && !ipa_equal(a->from, a->gw))
+    {
+      p = rt_json_raw(p, ",\"from\":");
+      p = rt_json_ip(p, a->from);
+    }
+
+  p = rt_json_raw(p, ",\"pref\":");
+  p = rt_json_uint(p, e->pref);
+  p = rt_json_raw(p, ",\"age\":");
+  p = rt_json_uint(p, (now > e->lastmod) ? now - e->lastmod : 0);
+  p = rt_json_raw(p, (e->net->routes == e) ? ",\"primary\":true" : ",\"primary\":false");
+  if (e->net->n.flags & KRF_SYNC_ERROR)
+    p = rt_json_raw(p, ",\"sync_error\":true");
+
+  if (a->nexthops)
+    {
+      p = rt_json_raw(p, ",\"nexthops\":[");
+      for (nh = a->nexthops; nh && nhs--; nh = nh->next)
+	{
+	  p = rt_json_raw(p, "{\"gw\":");
+	  p = rt_json_ip(p, nh->gw);
+	  p = rt_json_raw(p, ",\"iface\":");
+	  p = rt_json_str(p, nh->iface->name);
+	  p = rt_json_raw(p, ",\"weight\":");
+	  p = rt_json_uint(p, nh->weight + 1);
+	  *p++ = '}';
+	  if (nh->next && nhs)
+	    *p++ = ',';
+	}
+      *p++ = ']';
+    }
+  *p++ = '}';
+
+  ASSERT(p - p0 <= max);
+  cli_line_end(c, p);
+}
+
 static void
 rt_show_net(struct cli *c, net *n, struct rt_show_data *d)
 {
@@ -1975,7 +2789,8 @@ rt_show_net(struct cli *c, net *n, struct rt_show_data *d)
   struct announce_hook *a;
   int ok;
 
-  bsprintf(ia, "%I/%d", n->n.prefix, n->n.pxlen);
+  if (!d->json)
+    bsprintf(ia, "%I/%d", n->n.prefix, n->n.pxlen);
   if (n->routes)
     d->net_counter++;
   for(e=n->routes; e; e=e->next)
@@ -2010,7 +2825,11 @@ rt_show_net(struct cli *c, net *n, struct rt_show_data *d)
       if (ok)
 	{
 	  d->show_counter++;
-	  if (d->stats < 2)
+	  if (d->stats >= 2)
+	    ;
+	  else if (d->json)
+	    rt_show_rte_json(c, e);
+	  else
 	    rt_show_rte(c, ia, e, d, tmpa);
 	  ia[0] = 0;
 	}
@@ -2032,7 +2851,8 @@ rt_show_cont(struct cli *c)
 #ifdef DEBUGGING
   unsigned max = 4;
 #else
-  unsigned max = 64;
+  /* Next batch is produced after the previous one is sent to the client */
+  unsigned max = d->json ? 512 : 64;
 #endif
   struct fib *fib = &d->table->fib;
   struct fib_iterator *it = &d->fit;
@@ -462,13 +462,14 @@ bgp_get_attr_len(eattr *a)
 
 /**
  * bgp_encode_attrs - encode BGP attributes
- * @p: BGP instance
+ * @p: BGP instance (%NULL when encoding for MRT dumps)
  * @w: buffer
  * @attrs: a list of extended attributes
  * @remains: remaining space in the buffer
  *
  * The bgp_encode_attrs() function takes a list of extended attributes
  * and converts it to its BGP representation (a part of an Update message).
+ * Without a BGP instance, 4B AS numbers are used.
  *
  * Result: Length of the attribute block generated or -1 if not enough space.
  */
@@ -478,6 +479,7 @@ bgp_encode_attrs(struct bgp_proto *p, byte *w, ea_list *attrs, int remains)
   unsigned int i, code, type, flags;
   byte *start = w;
   int len, rv;
+  int as4 = p ? p->as4_session : 1;
 
   for(i=0; i<attrs->count; i++)
     {
@@ -495,7 +497,7 @@ bgp_encode_attrs(struct bgp_proto *p, byte *w, ea_list *attrs, int remains)
        * we have to convert our 4B AS_PATH to 2B AS_PATH and send our AS_PATH 
        * as optional AS4_PATH attribute.
        */
-      if ((code == BA_AS_PATH) && (! p->as4_session))
+      if ((code == BA_AS_PATH) && (! as4))
 	{
 	  len = a->u.ptr->length;
 
@@ -537,7 +539,7 @@ bgp_encode_attrs(struct bgp_proto *p, byte *w, ea_list *attrs, int remains)
 	}
 
       /* The same issue with AGGREGATOR attribute */
-      if ((code == BA_AGGREGATOR) && (! p->as4_session))
+      if ((code == BA_AGGREGATOR) && (! as4))
 	{
 	  int new_used;
 
@@ -621,6 +623,112 @@ bgp_encode_attrs(struct bgp_proto *p, byte *w, ea_list *attrs, int remains)
   return -1;
 }
 
+/**
+ * bgp_encode_mrt_attrs - encode route attributes for MRT table dumps
+ * @e: route
+ * @w: buffer
+ * @remains: remaining space in the buffer
+ * @pool: linpool for temporary data
+ *
+ * This function encodes BGP attributes of the route @e in the form
+ * used by RIB entries of MRT TABLE_DUMP_V2 records (RFC 6396), i.e.
+ * with 4B AS numbers and (in IPv6) with a MP_REACH_NLRI attribute
+ * containing just the next hop. Routes from other protocols get an
+ * empty AS_PATH, an incomplete ORIGIN and their gateway as a next hop.
+ *
+ * Result: Length of the attribute block generated or -1 if not enough space.
+ */
+int
+bgp_encode_mrt_attrs(rte *e, byte *w, int remains, struct linpool *pool)
+{
+  rta *a = e->attrs;
+  unsigned i, code, cnt;
+  u32 seen = 0;
+  ea_list *t;
+  int len;
+#ifdef IPV6
+  eattr *nh = NULL;
+#endif
+
+  /* Merge the attribute list, reserving space for missing mandatory attributes */
+  t = lp_alloc(pool, (a->eattrs ? ea_scan(a->eattrs) : sizeof(ea_list)) + 3 * sizeof(eattr));
+  if (a->eattrs)
+    {
+      ea_merge(a->eattrs, t);
+      ea_sort(t);
+    }
+  else
+    {
+      t->next = NULL;
+      t->count = 0;
+    }
+
+  cnt = t->count;
+  t->count = 0;
+  for (i = 0; i < cnt; i++)
+    {
+      eattr *ea = &t->attrs[i];
+      if (EA_PROTO(ea->id) != EAP_BGP)
+	continue;
+      code = EA_ID(ea->id);
+      if ((code == BA_MP_REACH_NLRI) || (code == BA_MP_UNREACH_NLRI))
+	continue;
+#ifdef IPV6
+      if (code == BA_NEXT_HOP)
+	nh = ea;
+#endif
+      if (ATTR_KNOWN(code))
+	{
+	  ea->flags = (ea->flags & BAF_PARTIAL) | bgp_attr_table[code].expected_flags;
+	  if (code < 32)
+	    seen |= 1 << code;
+	}
+      t->attrs[t->count++] = *ea;
+    }
+
+  if (!(seen & (1 << BA_ORIGIN)))
+    bgp_set_attr(&t->attrs[t->count++], BA_ORIGIN, ORIGIN_INCOMPLETE);
+  if (!(seen & (1 << BA_AS_PATH)))
+    bgp_set_attr(&t->attrs[t->count++], BA_AS_PATH, (uintptr_t) bgp_alloc_adata(pool, 0));
+#ifndef IPV6
+  if (!(seen & (1 << BA_NEXT_HOP)))
+    *(ip_addr *) bgp_set_attr_wa(&t->attrs[t->count++], pool, BA_NEXT_HOP, sizeof(ip_addr)) = a->gw;
+#endif
+  t->flags = 0;
+  ea_sort(t);
+
+  len = bgp_encode_attrs(NULL, w, t, remains);
+  if (len < 0)
+    return -1;
+
+#ifdef IPV6
+  {
+    /* The MP_REACH_NLRI attribute contains just the next hop here */
+    ip_addr *nhs = nh ? (ip_addr *) nh->u.ptr->data : &a->gw;
+    int nhlen = (nh && (nh->u.ptr->length == NEXT_HOP_LENGTH) && ipa_nonzero(nhs[1])) ?
+      NEXT_HOP_LENGTH : sizeof(ip_addr);
+    byte *b;
+
+    if (remains - len < nhlen + 4)
+      return -1;
+
+    b = w + len;
+    b += bgp_encode_attr_hdr(b, BAF_OPTIONAL, BA_MP_REACH_NLRI, nhlen + 1);
+    *b++ = nhlen;
+    for (i = 0; i < nhlen / sizeof(ip_addr); i++)
+      {
+	ip_addr ip = nhs[i];
+	ipa_hton(ip);
+	memcpy(b, &ip, sizeof(ip_addr));
+	b += sizeof(ip_addr);
+      }
+    len = b - w;
+  }
+#endif
+
+  return len;
+}
+
 static void
 bgp_init_prefix(struct fib_node *N)
 {
@@ -972,14 +1080,14 @@ static inline void
 bgp_path_prepend(rte *e, ea_list **attrs, struct linpool *pool, u32 as)
 {
   eattr *a = ea_find(e->attrs->eattrs, EA_CODE(EAP_BGP, BA_AS_PATH));
-  bgp_attach_attr(attrs, pool, BA_AS_PATH, (uintptr_t) as_path_prepend(pool, a->u.ptr, as));
+  bgp_attach_attr(attrs, pool, BA_AS_PATH, (uintptr_t) as_path_prepend(a->u.ptr, as));
 }
 
 static inline void
 bgp_cluster_list_prepend(rte *e, ea_list **attrs, struct linpool *pool, u32 cid)
 {
   eattr *a = ea_find(e->attrs->eattrs, EA_CODE(EAP_BGP, BA_CLUSTER_LIST));
-  bgp_attach_attr(attrs, pool, BA_CLUSTER_LIST, (uintptr_t) int_set_add(pool, a ? a->u.ptr : NULL, cid));
+  bgp_attach_attr(attrs, pool, BA_CLUSTER_LIST, (uintptr_t) int_set_add(a ? a->u.ptr : NULL, cid));
 }
 
 static int
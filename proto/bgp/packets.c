@@ -581,6 +581,7 @@ bgp_fire_tx(struct bgp_conn *conn)
     return 0;
   conn->packets_to_send = s;
   bgp_create_header(buf, end - buf, type);
+  conn->bgp->p.perf.tx_packets++;
   return sk_send(sk, end - buf);
 }
 
@@ -1052,6 +1053,7 @@ bgp_rx_update(struct bgp_conn *conn, byte *pkt, int len)
   struct bgp_proto *p = conn->bgp;
   byte *withdrawn, *attrs, *nlri;
   int withdrawn_len, attr_len, nlri_len;
+  lp_state tmp_state;
 
   BGP_TRACE_RL(&rl_rcv_update, D_PACKETS, "Got UPDATE");
 
@@ -1083,9 +1085,9 @@ bgp_rx_update(struct bgp_conn *conn, byte *pkt, int len)
     goto malformed;
   DBG("Sizes: withdrawn=%d, attrs=%d, NLRI=%d\n", withdrawn_len, attr_len, nlri_len);
 
-  lp_flush(bgp_linpool);
-
+  lp_save(bgp_linpool, &tmp_state);
   bgp_do_rx_update(conn, withdrawn, withdrawn_len, nlri, nlri_len, attrs, attr_len);
+  lp_restore(bgp_linpool, &tmp_state);
   return;
 
 malformed:
@@ -1296,6 +1298,7 @@ bgp_rx_packet(struct bgp_conn *conn, byte *pkt, unsigned len)
   byte type = pkt[18];
 
   DBG("BGP: Got packet %02x (%d bytes)\n", type, len);
+  conn->bgp->p.perf.rx_packets++;
 
   if (conn->bgp->p.mrtdump & MD_MESSAGES)
     mrt_dump_bgp_packet(conn, pkt, len);
@@ -0,0 +1,546 @@
+/*
+ *	BIRD -- MRT Table Dumps
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+/**
+ * DOC: MRT Table Dumps
+ *
+ * The MRT protocol periodically writes snapshots of a routing table
+ * to files in the MRT TABLE_DUMP_V2 format (RFC 6396), which is
+ * understood by common offline route analysis tools. It neither
+ * imports nor exports any routes, it is attached to its table just to
+ * lock it and to walk it.
+ *
+ * Each dump starts with a PEER_INDEX_TABLE record describing all
+ * running protocols (BGP sessions are described by their neighbor
+ * address, AS number and BGP identifier), followed by one
+ * RIB_IPV4_UNICAST or RIB_IPV6_UNICAST record for each network with
+ * at least one route accepted by the export filter. Route attributes
+ * are encoded by the BGP code, see bgp_encode_mrt_attrs().
+ *
+ * The table is walked using a FIB iterator from an event, at most
+ * %MRT_MAX_NETS networks at a time, so a dump of a large table does
+ * not block the main loop. The output is written to a temporary file
+ * which is renamed to its final name (given by a strftime() format)
+ * when the dump is complete, so readers never see partial dumps.
+ */
+
+#undef LOCAL_DEBUG
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <stdio.h>
+
+#include "nest/bird.h"
+#include "nest/iface.h"
+#include "nest/protocol.h"
+#include "nest/route.h"
+#include "nest/cli.h"
+#include "nest/mrtdump.h"
+#include "conf/conf.h"
+#include "filter/filter.h"
+#include "lib/string.h"
+#include "proto/bgp/bgp.h"
+
+#include "mrt.h"
+
+static int
+mrt_flush_buffer(struct mrt_proto *p)
+{
+  byte *b = p->buf;
+
+  while (b < p->bpos)
+    {
+      int l = write(p->fd, b, p->bpos - b);
+      if (l < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  log(L_ERR "%s: Error writing %s: %m", p->p.name, p->tmp_name);
+	  return 0;
+	}
+      b += l;
+    }
+
+  p->bpos = p->buf;
+  return 1;
+}
+
+static void
+mrt_dump_close(struct mrt_proto *p, int ok)
+{
+  if (p->dumping)
+    fit_get(&p->p.table->fib, &p->fit);
+  p->dumping = 0;
+
+  if (p->fd >= 0)
+    {
+      if (ok && !mrt_flush_buffer(p))
+	ok = 0;
+      close(p->fd);
+      p->fd = -1;
+
+      if (ok && (rename(p->tmp_name, p->file_name) < 0))
+	{
+	  log(L_ERR "%s: Cannot rename %s to %s: %m", p->p.name, p->tmp_name, p->file_name);
+	  ok = 0;
+	}
+      if (!ok)
+	unlink(p->tmp_name);
+    }
+
+  if (ok)
+    {
+      p->last_dump = now;
+      p->last_nets = p->dump_nets;
+      p->last_routes = p->dump_routes;
+      p->dumps_done++;
+      DBG("%s: Dump finished, %u networks, %u routes\n", p->p.name, p->dump_nets, p->dump_routes);
+      if (p->dump_skipped)
+	log(L_WARN "%s: %u routes skipped, their protocols are not in the peer table", p->p.name, p->dump_skipped);
+    }
+  else
+    p->dumps_failed++;
+
+  if (p->file_name)
+    mb_free(p->file_name);
+  if (p->tmp_name)
+    mb_free(p->tmp_name);
+  if (p->peers)
+    mb_free(p->peers);
+  p->file_name = p->tmp_name = NULL;
+  p->peers = NULL;
+}
+
+static inline byte *
+mrt_put_ip(byte *b, ip_addr a)
+{
+  ipa_hton(a);
+  memcpy(b, &a, sizeof(ip_addr));
+  return b + sizeof(ip_addr);
+}
+
+static byte *
+mrt_put_header(byte *b, u16 subtype, u32 len)
+{
+  put_u32(b+0, now_real);
+  put_u16(b+4, TABLE_DUMP_V2);
+  put_u16(b+6, subtype);
+  put_u32(b+8, len - MRTDUMP_HDR_LENGTH);
+  return b + MRTDUMP_HDR_LENGTH;
+}
+
+static int
+mrt_peer_cmp(const void *x, const void *y)
+{
+  struct proto *a = ((struct mrt_peer *) x)->proto;
+  struct proto *b = ((struct mrt_peer *) y)->proto;
+
+  return (a > b) - (a < b);
+}
+
+static int
+mrt_peer_index(struct mrt_proto *p, struct proto *q)
+{
+  int l = 0, r = p->peer_count - 1;
+
+  while (l <= r)
+    {
+      int m = (l + r) / 2;
+      if (p->peers[m].proto == q)
+	return m;
+      if (p->peers[m].proto < q)
+	l = m + 1;
+      else
+	r = m - 1;
+    }
+
+  return -1;
+}
+
+/*
+ * The peer table is written once when the dump starts, but protocols
+ * may come and go before the dump finishes. Before each batch, mark
+ * peers which are no longer active (or whose memory has been reused by
+ * another protocol) as gone. Once gone, a peer stays gone, so routes of
+ * a new protocol are never attributed to an old peer index.
+ */
+static void
+mrt_check_peers(struct mrt_proto *p)
+{
+  struct proto *q;
+  unsigned i;
+  int idx;
+
+  for (i = 0; i < p->peer_count; i++)
+    p->peers[i].seen = 0;
+
+  WALK_LIST(q, active_proto_list)
+    if (((idx = mrt_peer_index(p, q)) >= 0) && (p->peers[idx].hash_key == q->hash_key))
+      p->peers[idx].seen = 1;
+
+  for (i = 0; i < p->peer_count; i++)
+    if (!p->peers[i].seen)
+      p->peers[i].gone = 1;
+}
+
+static void
+mrt_put_peer_table(struct mrt_proto *p)
+{
+  byte *b = p->bpos + MRTDUMP_HDR_LENGTH;
+  struct proto *q;
+  unsigned i, len, cnt = 0;
+
+  WALK_LIST(q, active_proto_list)
+    cnt++;
+  cnt = MIN(cnt, (MRT_BUFFER_SIZE - 512) / (9 + sizeof(ip_addr)));
+  cnt = MIN(cnt, 0xffff);
+
+  p->peers = mb_alloc(p->p.pool, (cnt ? cnt : 1) * sizeof(struct mrt_peer));
+  p->peer_count = 0;
+  WALK_LIST(q, active_proto_list)
+    if (p->peer_count < cnt)
+      {
+	struct mrt_peer *pe = &p->peers[p->peer_count++];
+	pe->proto = q;
+	pe->hash_key = q->hash_key;
+	pe->gone = pe->seen = 0;
+      }
+  qsort(p->peers, p->peer_count, sizeof(struct mrt_peer), mrt_peer_cmp);
+
+  put_u32(b, config->router_id);
+  len = MIN(strlen(p->p.table->name), 255);
+  put_u16(b+4, len);
+  memcpy(b+6, p->p.table->name, len);
+  b += 6 + len;
+  put_u16(b, p->peer_count);
+  b += 2;
+
+  for (i = 0; i < p->peer_count; i++)
+    {
+      u32 id = config->router_id, as = 0;
+      ip_addr addr = IPA_NONE;
+
+      q = p->peers[i].proto;
+      if (q->proto == &proto_bgp)
+	{
+	  struct bgp_proto *bgp = (struct bgp_proto *) q;
+	  id = bgp->remote_id;
+	  as = bgp->remote_as;
+	  addr = bgp->cf->remote_ip;
+	}
+
+#ifdef IPV6
+      *b++ = 0x03;			/* IPv6 address, 4B AS number */
+#else
+      *b++ = 0x02;			/* IPv4 address, 4B AS number */
+#endif
+      put_u32(b, id);
+      b = mrt_put_ip(b + 4, addr);
+      put_u32(b, as);
+      b += 4;
+    }
+
+  mrt_put_header(p->bpos, PEER_INDEX_TABLE, b - p->bpos);
+  p->bpos = b;
+}
+
+static void
+mrt_put_net(struct mrt_proto *p, net *n)
+{
+  struct filter *filter = p->p.cf->out_filter;
+  byte *start = p->bpos;
+  byte *end = start + MRT_RECORD_MAX;
+  byte *b = start + MRTDUMP_HDR_LENGTH;
+  byte *cntp;
+  unsigned cnt = 0;
+  rte *e, *ee;
+
+  /* Sequence number is filled in later, only for non-empty records */
+  b += 4;
+  *b++ = n->n.pxlen;
+  {
+    byte px[sizeof(ip_addr)];
+    mrt_put_ip(px, n->n.prefix);
+    memcpy(b, px, (n->n.pxlen + 7) / 8);
+    b += (n->n.pxlen + 7) / 8;
+  }
+  cntp = b;
+  b += 2;
+
+  for (e = n->routes; e && (cnt < 0xffff); e = e->next)
+    {
+      struct proto *src = e->attrs->proto;
+      ea_list *tmpa;
+      int idx, len, ok;
+
+      if (((idx = mrt_peer_index(p, src)) < 0) || p->peers[idx].gone)
+	{
+	  p->dump_skipped++;
+	  continue;
+	}
+
+      ee = e;
+      tmpa = src->make_tmp_attrs ? src->make_tmp_attrs(e, p->lp) : NULL;
+      ok = (filter == FILTER_ACCEPT) ||
+	((filter != FILTER_REJECT) && (f_run(filter, &e, &tmpa, p->lp, FF_FORCE_TMPATTR) <= F_ACCEPT));
+
+      if (ok && (end - b >= 8))
+	{
+	  len = bgp_encode_mrt_attrs(e, b + 8, end - b - 8, p->lp);
+	  if (len >= 0)
+	    {
+	      put_u16(b, idx);
+	      put_u32(b+2, now_real - (now - e->lastmod));
+	      put_u16(b+6, len);
+	      b += 8 + len;
+	      cnt++;
+	    }
+	  else
+	    log(L_WARN "%s: Attributes of a route for %I/%d too long", p->p.name, n->n.prefix, n->n.pxlen);
+	}
+
+      if (e != ee)
+	rte_free(e);
+      lp_flush(p->lp);
+    }
+
+  if (!cnt)
+    return;
+
+  put_u32(start + MRTDUMP_HDR_LENGTH, p->seq++);
+  put_u16(cntp, cnt);
+#ifdef IPV6
+  mrt_put_header(start, RIB_IPV6_UNICAST, b - start);
+#else
+  mrt_put_header(start, RIB_IPV4_UNICAST, b - start);
+#endif
+  p->bpos = b;
+  p->dump_nets++;
+  p->dump_routes += cnt;
+}
+
+static void
+mrt_dump_cont(void *P)
+{
+  struct mrt_proto *p = P;
+  struct fib *fib = &p->p.table->fib;
+  unsigned max = MRT_MAX_NETS;
+
+  mrt_check_peers(p);
+
+  FIB_ITERATE_START(fib, &p->fit, f)
+    {
+      if (!max--)
+	{
+	  FIB_ITERATE_PUT(&p->fit, f);
+	  if (!mrt_flush_buffer(p))
+	    mrt_dump_close(p, 0);
+	  else
+	    ev_schedule(p->dump_event);
+	  return;
+	}
+
+      if ((MRT_BUFFER_SIZE - (p->bpos - p->buf) < MRT_RECORD_MAX) && !mrt_flush_buffer(p))
+	{
+	  FIB_ITERATE_PUT(&p->fit, f);
+	  mrt_dump_close(p, 0);
+	  return;
+	}
+
+      mrt_put_net(p, (net *) f);
+    }
+  FIB_ITERATE_END(f);
+
+  /* The iterator is no longer linked */
+  p->dumping = 0;
+  mrt_dump_close(p, 1);
+}
+
+static void
+mrt_dump_start(struct mrt_proto *p)
+{
+  struct mrt_config *cf = (struct mrt_config *) p->p.cf;
+  time_t tm = now_real;
+  char name[1024];
+
+  if (p->dumping)
+    {
+      log(L_WARN "%s: Previous dump still in progress, skipping", p->p.name);
+      return;
+    }
+
+  if (!strftime(name, sizeof(name), cf->filename, localtime(&tm)))
+    {
+      log(L_ERR "%s: Invalid file name", p->p.name);
+      p->dumps_failed++;
+      return;
+    }
+
+  p->file_name = mb_alloc(p->p.pool, strlen(name) + 1);
+  strcpy(p->file_name, name);
+  p->tmp_name = mb_alloc(p->p.pool, strlen(name) + 5);
+  bsprintf(p->tmp_name, "%s.tmp", name);
+
+  p->fd = open(p->tmp_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (p->fd < 0)
+    {
+      log(L_ERR "%s: Cannot create %s: %m", p->p.name, p->tmp_name);
+      mrt_dump_close(p, 0);
+      return;
+    }
+
+  DBG("%s: Dumping table %s to %s\n", p->p.name, p->p.table->name, p->file_name);
+  p->seq = 0;
+  p->dump_nets = p->dump_routes = p->dump_skipped = 0;
+  p->bpos = p->buf;
+  mrt_put_peer_table(p);
+
+  FIB_ITERATE_INIT(&p->fit, &p->p.table->fib);
+  p->dumping = 1;
+  ev_schedule(p->dump_event);
+}
+
+static void
+mrt_dump_timer(timer *t)
+{
+  mrt_dump_start(t->data);
+}
+
+static struct proto *
+mrt_init(struct proto_config *C)
+{
+  return proto_new(C, sizeof(struct mrt_proto));
+}
+
+static int
+mrt_start(struct proto *P)
+{
+  struct mrt_proto *p = (struct mrt_proto *) P;
+  struct mrt_config *cf = (struct mrt_config *) P->cf;
+
+  /* Unlock is handled in mrt_cleanup() */
+  rt_lock_table(P->table);
+
+  p->fd = -1;
+  p->dumping = 0;
+  p->buf = p->bpos = mb_alloc(P->pool, MRT_BUFFER_SIZE);
+  p->lp = lp_new(P->pool, 4080);
+  p->dump_event = ev_new(P->pool);
+  p->dump_event->hook = mrt_dump_cont;
+  p->dump_event->data = p;
+  p->dump_timer = tm_new_set(P->pool, mrt_dump_timer, p, 0, cf->period);
+  tm_start(p->dump_timer, cf->period);
+
+  return PS_UP;
+}
+
+static int
+mrt_shutdown(struct proto *P)
+{
+  struct mrt_proto *p = (struct mrt_proto *) P;
+
+  tm_stop(p->dump_timer);
+  ev_postpone(p->dump_event);
+  if (p->dumping || (p->fd >= 0))
+    mrt_dump_close(p, 0);
+
+  return PS_DOWN;
+}
+
+static void
+mrt_cleanup(struct proto *P)
+{
+  rt_unlock_table(P->table);
+}
+
+static void
+mrt_postconfig(struct proto_config *C)
+{
+  struct mrt_config *c = (struct mrt_config *) C;
+
+  if (!c->filename)
+    cf_error("File name not specified");
+}
+
+static int
+mrt_reconfigure(struct proto *P, struct proto_config *new)
+{
+  struct mrt_proto *p = (struct mrt_proto *) P;
+  struct mrt_config *oc = (struct mrt_config *) P->cf;
+  struct mrt_config *nc = (struct mrt_config *) new;
+
+  if (P->table != new->table->table)
+    return 0;
+
+  if (oc->period != nc->period)
+    {
+      p->dump_timer->recurrent = nc->period;
+      tm_start(p->dump_timer, nc->period);
+    }
+
+  return 1;
+}
+
+static void
+mrt_copy_config(struct proto_config *dest, struct proto_config *src)
+{
+  /* Just a shallow copy, not many items here */
+  proto_copy_rest(dest, src, sizeof(struct mrt_config));
+}
+
+static void
+mrt_get_status(struct proto *P, byte *buf)
+{
+  struct mrt_proto *p = (struct mrt_proto *) P;
+
+  if (p->dumping)
+    bsprintf(buf, "Dumping %s", P->table->name);
+  else
+    bsprintf(buf, "%s", P->table->name);
+}
+
+static void
+mrt_show_proto_info(struct proto *P)
+{
+  struct mrt_proto *p = (struct mrt_proto *) P;
+  struct mrt_config *cf = (struct mrt_config *) P->cf;
+  byte tbuf[TM_DATETIME_BUFFER_SIZE];
+
+  cli_msg(-1006, "  Table:          %s", P->table->name);
+  cli_msg(-1006, "  Filter:         %s", filter_name(cf->c.out_filter));
+  cli_msg(-1006, "  File name:      %s", cf->filename);
+  cli_msg(-1006, "  Period:         %u", cf->period);
+
+  if (P->proto_state == PS_DOWN)
+    return;
+
+  cli_msg(-1006, "  Dumps:          %u done, %u failed", p->dumps_done, p->dumps_failed);
+  if (p->dumps_done)
+    {
+      tm_format_datetime(tbuf, &config->tf_proto, p->last_dump);
+      cli_msg(-1006, "  Last dump:      %s, %u networks, %u routes", tbuf, p->last_nets, p->last_routes);
+    }
+  if (p->dumping)
+    cli_msg(-1006, "  Dumping:        %s, %u networks so far", p->file_name, p->dump_nets);
+}
+
+struct protocol proto_mrt = {
+  name:			"MRT",
+  template:		"mrt%d",
+  multitable:		1,
+  postconfig:		mrt_postconfig,
+  init:			mrt_init,
+  start:		mrt_start,
+  shutdown:		mrt_shutdown,
+  cleanup:		mrt_cleanup,
+  reconfigure:		mrt_reconfigure,
+  copy_config:		mrt_copy_config,
+  get_status:		mrt_get_status,
+  show_proto_info:	mrt_show_proto_info
+};
@@ -0,0 +1,52 @@
+/*
+ *	BIRD -- MRT Table Dumps
+ *
+ *	Can be freely distributed and used under the terms of the GNU GPL.
+ */
+
+#ifndef _BIRD_MRT_H_
+#define _BIRD_MRT_H_
+
+#include "nest/route.h"
+#include "lib/timer.h"
+#include "lib/event.h"
+
+struct mrt_config {
+  struct proto_config c;
+  char *filename;			/* Output file name, strftime() format */
+  unsigned period;			/* Time between dumps */
+};
+
+struct mrt_peer {
+  struct proto *proto;			/* Protocol the routes come from */
+  u32 hash_key;				/* Its hash_key, to detect reused addresses */
+  byte gone;				/* Protocol has left active_proto_list */
+  byte seen;				/* Temporary mark used by mrt_check_peers() */
+};
+
+struct mrt_proto {
+  struct proto p;
+  timer *dump_timer;			/* Starts periodic dumps */
+  event *dump_event;			/* Writes the next batch of networks */
+  linpool *lp;				/* Temporary data for route filtering and encoding */
+  struct fib_iterator fit;
+  int dumping;				/* Dump in progress, fit is linked to the table */
+  int fd;				/* Temporary output file */
+  char *file_name, *tmp_name;		/* Output file and its temporary name */
+  byte *buf, *bpos;			/* Output buffer */
+  struct mrt_peer *peers;		/* Peer index table, sorted by address */
+  unsigned peer_count;
+  u32 seq;				/* RIB record sequence number */
+  u32 dump_nets, dump_routes;		/* Statistics of the current dump */
+  u32 dump_skipped;			/* Routes from protocols not in the peer table */
+
+  bird_clock_t last_dump;		/* Last completed dump */
+  u32 last_nets, last_routes;		/* Statistics of the last completed dump */
+  u32 dumps_done, dumps_failed;
+};
+
+#define MRT_BUFFER_SIZE 131072
+#define MRT_RECORD_MAX 65536		/* Maximum size of a single record */
+#define MRT_MAX_NETS 256		/* Networks written per event */
+
+#endif
@@ -39,6 +39,7 @@ do { if ((p->debug & D_PACKETS) || OSPF_FORCE_DEBUG) \
 #include "lib/lists.h"
 #include "lib/slists.h"
 #include "lib/socket.h"
+#include "lib/perf.h"
 #include "lib/timer.h"
 #include "lib/resource.h"
 #include "nest/protocol.h"
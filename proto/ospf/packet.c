@@ -270,6 +270,8 @@ ospf_rx_hook(sock *sk, int size)
   struct proto_ospf *po = ifa->oa->po;
   // struct proto *p = &po->proto;
 
+  po->proto.perf.rx_packets++;
+
   int src_local, dst_local UNUSED, dst_mcast;
   src_local = ipa_in_net(sk->faddr, ifa->addr->prefix, ifa->addr->pxlen);
   dst_local = ipa_equal(sk->laddr, ifa->addr->ip);
@@ -563,6 +565,7 @@ ospf_send_to(struct ospf_iface *ifa, ip_addr dst)
   if (sk->tbuf != sk->tpos)
     log(L_ERR "Aiee, old packet was overwritten in TX buffer");
 
+  ifa->oa->po->proto.perf.tx_packets++;
   sk_send_to(sk, len, dst, 0);
 }
 
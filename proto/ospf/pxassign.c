@@ -398,6 +398,8 @@ ospf_pxassign(struct proto_ospf *po)
   struct proto *p = &po->proto;
   struct ospf_area *oa;
 
+  u64 start = perf_start();
+
   OSPF_TRACE(D_EVENTS, "Starting prefix assignment algorithm");
 
   WALK_LIST(oa, po->area_list)
@@ -405,6 +407,8 @@ ospf_pxassign(struct proto_ospf *po)
     // prefix assignment algorithm
     ospf_pxassign_area(oa);
   }
+
+  perf_end(PERF_PXASSIGN, start);
 }
 
 /**
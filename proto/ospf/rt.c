@@ -1604,11 +1604,13 @@ ospf_rt_spf(struct proto_ospf *po)
 {
   struct proto *p = &po->proto;
   struct ospf_area *oa;
+  u64 start;
 
   if (po->areano == 0)
     return;
 
   OSPF_TRACE(D_EVENTS, "Starting routing table calculation");
+  start = perf_start();
 
   /* 16. (1) */
   ospf_rt_reset(po);
@@ -1643,6 +1645,7 @@ ospf_rt_spf(struct proto_ospf *po)
 #endif
 
   po->calcrt = 0;
+  perf_end(PERF_SPF, start);
 }
 
 
@@ -28,6 +28,15 @@
  * set to accept, while user configured 'import' and 'export' filters
  * are used as export filters in ahooks 2 and 1. Route limits are
  * handled similarly, but on the import side of ahooks.
+ *
+ * In the bulk mode, routes are propagated like in the transparent
+ * mode, but whenever the exported route can be passed unchanged (that
+ * is, it still carries its cached &rta, there are no temporary
+ * attributes, which are also where changes done by the export filter
+ * end, and there is no recursive next hop bound to the source table),
+ * the new &rte in the peer table just takes another reference to the
+ * very same &rta instead of copying it and looking it up in the
+ * attribute cache again. Other routes are copied as usual.
  */
 
 #undef LOCAL_DEBUG
@@ -43,6 +52,21 @@
 
 #include "pipe.h"
 
+/*
+ * A route may be shared with the peer table if its attributes are the
+ * cached ones and there are no temporary attributes in @attrs. Pipe
+ * export filters run with FF_FORCE_TMPATTR, so they store attribute
+ * changes there and leave the cached &rta untouched. Routes with
+ * a hostentry have to be copied, as the hostentry belongs to the
+ * hostcache of the source table.
+ */
+static inline int
+pipe_can_share(rte *e, ea_list *attrs)
+{
+  return (e->attrs->aflags & RTAF_CACHED) && (attrs == e->attrs->eattrs) &&
+    !e->attrs->hostentry;
+}
+
 static void
 pipe_rt_notify(struct proto *P, rtable *src_table, net *n, rte *new, rte *old, ea_list *attrs)
 {
@@ -66,7 +90,19 @@ pipe_rt_notify(struct proto *P, rtable *src_table, net *n, rte *new, rte *old, e
     }
 
   nn = net_get(dst_table, n->n.prefix, n->n.pxlen);
-  if (new)
+  if (new && (p->mode == PIPE_BULK) && pipe_can_share(new, attrs))
+    {
+      /* Share the cached rta, rte_update2() will skip rta_lookup() */
+      e = rte_get_temp(rta_clone(new->attrs));
+      e->net = nn;
+      memcpy(&(e->u), &(new->u), sizeof(e->u));
+      e->pref = new->pref;
+      e->pflags = new->pflags;
+
+      src = new->attrs->proto;
+      p->shared_updates++;
+    }
+  else if (new)
     {
       memcpy(&a, new->attrs, sizeof(rta));
 
@@ -83,7 +119,7 @@ pipe_rt_notify(struct proto *P, rtable *src_table, net *n, rte *new, rte *old, e
       e->net = nn;
       e->pflags = 0;
 
-      if (p->mode == PIPE_TRANSPARENT)
+      if (p->mode != PIPE_OPAQUE)
 	{
 	  /* Copy protocol specific embedded attributes. */
 	  memcpy(&(e->u), &(new->u), sizeof(e->u));
@@ -92,6 +128,8 @@ pipe_rt_notify(struct proto *P, rtable *src_table, net *n, rte *new, rte *old, e
 	}
 
       src = new->attrs->proto;
+      if (p->mode == PIPE_BULK)
+	p->copied_updates++;
     }
   else
     {
@@ -183,6 +221,7 @@ pipe_cleanup(struct proto *P)
 
   bzero(&P->stats, sizeof(struct proto_stats));
   bzero(&p->peer_stats, sizeof(struct proto_stats));
+  p->shared_updates = p->copied_updates = 0;
 
   P->main_ahook = NULL;
   p->peer_ahook = NULL;
@@ -251,7 +290,8 @@ pipe_get_status(struct proto *P, byte *buf)
 {
   struct pipe_proto *p = (struct pipe_proto *) P;
 
-  bsprintf(buf, "%c> %s", (p->mode == PIPE_OPAQUE) ? '-' : '=', p->peer_table->name);
+  bsprintf(buf, "%c> %s%s", (p->mode == PIPE_OPAQUE) ? '-' : '=', p->peer_table->name,
+	   (p->mode == PIPE_BULK) ? " (bulk)" : "");
 }
 
 static void
@@ -296,6 +336,10 @@ pipe_show_stats(struct pipe_proto *p)
   cli_msg(-1006, "    Export withdraws:   %10u %10u        --- %10u %10u",
 	  s1->exp_withdraws_received, s2->imp_withdraws_invalid,
 	  s2->imp_withdraws_ignored, s2->imp_withdraws_accepted);
+
+  if (p->mode == PIPE_BULK)
+    cli_msg(-1006, "  Bulk updates:   %u shared, %u copied",
+	    p->shared_updates, p->copied_updates);
 }
 
 static void
@@ -11,11 +11,12 @@
 
 #define PIPE_OPAQUE 0
 #define PIPE_TRANSPARENT 1
+#define PIPE_BULK 2			/* Transparent, sharing cached rta's with the peer table */
 
 struct pipe_config {
   struct proto_config c;
   struct rtable_config *peer;		/* Table we're connected to */
-  int mode;				/* PIPE_OPAQUE or PIPE_TRANSPARENT */
+  int mode;				/* PIPE_OPAQUE, PIPE_TRANSPARENT or PIPE_BULK */
 };
 
 struct pipe_proto {
@@ -23,7 +24,9 @@ struct pipe_proto {
   struct rtable *peer_table;
   struct announce_hook *peer_ahook;	/* Announce hook for direction peer->primary */
   struct proto_stats peer_stats;	/* Statistics for the direction peer->primary */
-  int mode;				/* PIPE_OPAQUE or PIPE_TRANSPARENT */
+  int mode;				/* PIPE_OPAQUE, PIPE_TRANSPARENT or PIPE_BULK */
+  u32 shared_updates;			/* Bulk mode: updates sharing the source rta */
+  u32 copied_updates;			/* Bulk mode: updates which had to be copied */
 };
 
 
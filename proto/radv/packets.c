@@ -79,7 +79,7 @@ static struct radv_prefix_config default_prefix = {
 };
 
 
-static struct radv_prefix_config *
+struct radv_prefix_config *
 radv_prefix_match(struct radv_iface *ifa, struct ifa *a)
 {
   struct proto *p = &ifa->ra->p;
@@ -100,6 +100,35 @@ radv_prefix_match(struct radv_iface *ifa, struct ifa *a)
   return &default_prefix;
 }
 
+static int
+radv_prepare_prefix(struct radv_iface *ifa, char **buf, char *bufend,
+		    ip_addr prefix, int pxlen, int onlink, int autonomous,
+		    u32 valid_lifetime, u32 preferred_lifetime)
+{
+  struct radv_opt_prefix *op = (void *) *buf;
+
+  if (*buf + sizeof(struct radv_opt_prefix) > bufend)
+  {
+    log(L_WARN "%s: Too many prefixes on interface %s",
+	ifa->ra->p.name, ifa->iface->name);
+    return -1;
+  }
+
+  op->type = OPT_PREFIX;
+  op->length = 4;
+  op->pxlen = pxlen;
+  op->flags = (onlink ? OPT_PX_ONLINK : 0) |
+    (autonomous ? OPT_PX_AUTONOMOUS : 0);
+  op->valid_lifetime = htonl(valid_lifetime);
+  op->preferred_lifetime = htonl(preferred_lifetime);
+  op->reserved = 0;
+  op->prefix = prefix;
+  ipa_hton(op->prefix);
+  *buf += sizeof(*op);
+
+  return 0;
+}
+
 static int
 radv_prepare_rdnss(struct radv_iface *ifa, list *rdnss_list, char **buf, char *bufend)
 {
@@ -235,15 +264,74 @@ radv_prepare_dnssl(struct radv_iface *ifa, list *dnssl_list, char **buf, char *b
   return -1;
 }
 
+/*
+ * RDNSS and DNSSL options depend only on the configuration, so they are
+ * prepared once (using tbuf as a scratch area) and kept in ifa->opts,
+ * to be appended to each RA rebuilt due to prefix changes.
+ */
 static void
-radv_prepare_ra(struct radv_iface *ifa)
+radv_prepare_opts(struct radv_iface *ifa)
 {
   struct proto_radv *ra = ifa->ra;
   struct radv_config *cf = (struct radv_config *) (ra->p.cf);
 
   char *buf = ifa->sk->tbuf;
   char *bufstart = buf;
-  char *bufend = buf + ifa->sk->tbsize;
+  char *bufend = buf + ifa->sk->tbsize - sizeof(struct radv_ra_packet);
+
+  if (! ifa->cf->rdnss_local)
+    if (radv_prepare_rdnss(ifa, &cf->rdnss_list, &buf, bufend) < 0)
+      goto done;
+
+  if (radv_prepare_rdnss(ifa, &ifa->cf->rdnss_list, &buf, bufend) < 0)
+    goto done;
+
+  if (! ifa->cf->dnssl_local)
+    if (radv_prepare_dnssl(ifa, &cf->dnssl_list, &buf, bufend) < 0)
+      goto done;
+
+  if (radv_prepare_dnssl(ifa, &ifa->cf->dnssl_list, &buf, bufend) < 0)
+    goto done;
+
+ done:
+  ifa->olen = buf - bufstart;
+  ifa->opts = NULL;
+
+  if (ifa->olen)
+  {
+    ifa->opts = mb_alloc(ra->p.pool, ifa->olen);
+    memcpy(ifa->opts, bufstart, ifa->olen);
+  }
+}
+
+/**
+ * radv_flush_opts - invalidate prepared RA options
+ * @ifa: RAdv interface
+ *
+ * This function should be called when the configuration of @ifa
+ * changes. Both the prepared RDNSS/DNSSL options and the RA itself
+ * are rebuilt before the next RA is sent.
+ */
+void
+radv_flush_opts(struct radv_iface *ifa)
+{
+  if (ifa->opts)
+    mb_free(ifa->opts);
+
+  ifa->opts = NULL;
+  ifa->olen = -1;
+  ifa->plen = 0;
+}
+
+static void
+radv_prepare_ra(struct radv_iface *ifa)
+{
+  if (ifa->olen < 0)
+    radv_prepare_opts(ifa);
+
+  char *buf = ifa->sk->tbuf;
+  char *bufstart = buf;
+  char *bufend = buf + ifa->sk->tbsize - ifa->olen;
 
   struct radv_ra_packet *pkt = (void *) buf;
   pkt->type = ICMPV6_RA;
@@ -276,45 +364,30 @@ radv_prepare_ra(struct radv_iface *ifa)
     if (!pc || pc->skip)
       continue;
 
-    if (buf + sizeof(struct radv_opt_prefix) > bufend)
-    {
-      log(L_WARN "%s: Too many prefixes on interface %s", ra->p.name, ifa->iface->name);
+    if (radv_prepare_prefix(ifa, &buf, bufend, addr->prefix, addr->pxlen,
+			    pc->onlink, pc->autonomous,
+			    pc->valid_lifetime, pc->preferred_lifetime) < 0)
       goto done;
-    }
-
-    struct radv_opt_prefix *op = (void *) buf;
-    op->type = OPT_PREFIX;
-    op->length = 4;
-    op->pxlen = addr->pxlen;
-    op->flags = (pc->onlink ? OPT_PX_ONLINK : 0) |
-      (pc->autonomous ? OPT_PX_AUTONOMOUS : 0);
-    op->valid_lifetime = htonl(pc->valid_lifetime);
-    op->preferred_lifetime = htonl(pc->preferred_lifetime);
-    op->reserved = 0;
-    op->prefix = addr->prefix;
-    ipa_hton(op->prefix);
-    buf += sizeof(*op);
   }
 
-  if (! ifa->cf->rdnss_local)
-    if (radv_prepare_rdnss(ifa, &cf->rdnss_list, &buf, bufend) < 0)
-      goto done;
-
-  if (radv_prepare_rdnss(ifa, &ifa->cf->rdnss_list, &buf, bufend) < 0)
-    goto done;
-
-  if (! ifa->cf->dnssl_local)
-    if (radv_prepare_dnssl(ifa, &cf->dnssl_list, &buf, bufend) < 0)
+  /* Withdrawn prefixes are announced with zero lifetimes, so hosts
+     deprecate the addresses instead of waiting for them to expire */
+  struct radv_withdrawn *w;
+  WALK_LIST(w, ifa->withdrawn)
+    if (radv_prepare_prefix(ifa, &buf, bufend, w->prefix, w->pxlen,
+			    w->onlink, w->autonomous, 0, 0) < 0)
       goto done;
 
-  if (radv_prepare_dnssl(ifa, &ifa->cf->dnssl_list, &buf, bufend) < 0)
-    goto done;
-
  done:
+  if (ifa->olen)
+  {
+    memcpy(buf, ifa->opts, ifa->olen);
+    buf += ifa->olen;
+  }
+
   ifa->plen = buf - bufstart;
 }
 
-
 void
 radv_send_ra(struct radv_iface *ifa, int shutdown)
 {
@@ -326,14 +399,20 @@ radv_send_ra(struct radv_iface *ifa, int shutdown)
 
   if (shutdown)
   {
-    /* Modify router lifetime to 0, it is not restored because
-       we suppose that the iface will be removed */
+    /* Modify router lifetime to 0, the prepared RA is rebuilt
+       if the iface is not removed after all */
     struct radv_ra_packet *pkt = (void *) ifa->sk->tbuf;
     pkt->router_lifetime = 0;
   }
 
   RADV_TRACE(D_PACKETS, "Sending RA via %s", ifa->iface->name);
   sk_send_to(ifa->sk, ifa->plen, AllNodes, 0);
+  ifa->ra_sent++;
+  ra->p.perf.tx_packets++;
+
+  /* The prepared RA is kept intact for the next RAs */
+  if (shutdown)
+    ifa->plen = 0;
 }
 
 
@@ -350,6 +429,8 @@ radv_rx_hook(sock *sk, int size)
   if (ipa_equal(sk->faddr, ifa->addr->ip))
     return 1;
 
+  ra->p.perf.rx_packets++;
+
   if (size < 8)
     return 1;
 
@@ -366,6 +447,7 @@ radv_rx_hook(sock *sk, int size)
   case ICMPV6_RS:
     RADV_TRACE(D_PACKETS, "Received RS from %I via %s",
 	       sk->faddr, ifa->iface->name);
+    ifa->rs_received++;
     radv_iface_notify(ifa, RA_EV_RS);
     return 1;
 
@@ -21,7 +21,12 @@
  * there is a structure &radv_iface that contains a state related to
  * that interface together with its resources (a socket, a timer).
  * There is also a prepared RA stored in a TX buffer of the socket
- * associated with an iface. These iface structures are created
+ * associated with an iface, sent unchanged until a prefix or the
+ * configuration changes; RDNSS and DNSSL options are kept prepared
+ * separately, as they change only with the configuration. Router
+ * Solicitations received while an RA is already scheduled within the
+ * minimal delay are answered by that RA, so a burst of RSs leads to
+ * one multicast RA. These iface structures are created
  * and removed according to iface events from BIRD core handled by
  * radv_if_notify() callback.
  *
@@ -30,11 +35,87 @@
  * by RA_EV_* codes), and radv_timer(), which triggers sending RAs and
  * computes the next timeout.
  *
+ * Address changes on an iface (e.g. prefixes assigned or withdrawn by
+ * the OSPF prefix assignment, which reach us through ifa_update() and
+ * ifa_delete()) are delivered by radv_ifa_notify(). They invalidate
+ * just the prepared RA of the affected iface and an unsolicited RA is
+ * sent as soon as the minimal delay between RAs allows. A withdrawn
+ * prefix is remembered in the &radv_withdrawn list of the iface and
+ * announced with zero lifetimes in the next few RAs, so hosts
+ * deprecate their addresses from it immediately.
+ *
  * Supported standards:
  * - RFC 4861 - main RA standard
  * - RFC 6106 - DNS extensions (RDDNS, DNSSL)
  */
 
+static void
+radv_withdrawn_age(struct radv_iface *ifa)
+{
+  struct radv_withdrawn *w, *wn;
+
+  WALK_LIST_DELSAFE(w, wn, ifa->withdrawn)
+    if (! --w->remains)
+    {
+      rem_node(NODE w);
+      mb_free(w);
+      ifa->plen = 0;
+    }
+}
+
+static struct radv_withdrawn *
+radv_withdrawn_find(struct radv_iface *ifa, struct ifa *a)
+{
+  struct radv_withdrawn *w;
+
+  WALK_LIST(w, ifa->withdrawn)
+    if ((w->pxlen == a->pxlen) && ipa_equal(w->prefix, a->prefix))
+      return w;
+
+  return NULL;
+}
+
+static void
+radv_prefix_withdraw(struct radv_iface *ifa, struct ifa *a)
+{
+  struct radv_prefix_config *pc = radv_prefix_match(ifa, a);
+  struct radv_withdrawn *w;
+  struct ifa *b;
+
+  if (!pc || pc->skip)
+    return;
+
+  /* The prefix may still be announced due to another address */
+  WALK_LIST(b, ifa->iface->addrs)
+    if ((b != a) && (b->pxlen == a->pxlen) && ipa_equal(b->prefix, a->prefix))
+      return;
+
+  w = radv_withdrawn_find(ifa, a);
+  if (!w)
+  {
+    w = mb_alloc(ifa->ra->p.pool, sizeof(struct radv_withdrawn));
+    w->prefix = a->prefix;
+    w->pxlen = a->pxlen;
+    add_tail(&ifa->withdrawn, NODE w);
+  }
+
+  w->onlink = pc->onlink;
+  w->autonomous = pc->autonomous;
+  w->remains = MAX_INITIAL_RTR_ADVERTISEMENTS;
+}
+
+static void
+radv_prefix_restore(struct radv_iface *ifa, struct ifa *a)
+{
+  struct radv_withdrawn *w = radv_withdrawn_find(ifa, a);
+
+  if (w)
+  {
+    rem_node(NODE w);
+    mb_free(w);
+  }
+}
+
 static void
 radv_timer(timer *tm)
 {
@@ -44,6 +125,7 @@ radv_timer(timer *tm)
   RADV_TRACE(D_EVENTS, "Timer fired on %s", ifa->iface->name);
 
   radv_send_ra(ifa, 0);
+  radv_withdrawn_age(ifa);
 
   /* Update timer */
   ifa->last = now;
@@ -90,6 +172,14 @@ radv_iface_notify(struct radv_iface *ifa, int event)
   if (delta < ifa->cf->min_delay)
     after = ifa->cf->min_delay - delta;
 
+  /* Never postpone an already scheduled RA */
+  if (ifa->timer->expires && (ifa->timer->expires <= now + after))
+  {
+    if (event == RA_EV_RS)
+      ifa->rs_coalesced++;
+    return;
+  }
+
   tm_start(ifa->timer, after);
 }
 
@@ -143,6 +233,8 @@ radv_iface_new(struct proto_radv *ra, struct iface *iface, struct radv_iface_con
   ifa->ra = ra;
   ifa->cf = cf;
   ifa->iface = iface;
+  ifa->olen = -1;
+  init_list(&ifa->withdrawn);
 
   add_tail(&ra->iface_list, NODE ifa);
 
@@ -180,6 +272,11 @@ radv_iface_remove(struct radv_iface *ifa)
 
   rem_node(NODE ifa);
 
+  struct radv_withdrawn *w, *wn;
+  WALK_LIST_DELSAFE(w, wn, ifa->withdrawn)
+    mb_free(w);
+
+  radv_flush_opts(ifa);
   rfree(ifa->sk);
   rfree(ifa->timer);
   rfree(ifa->lock);
@@ -234,8 +331,15 @@ radv_ifa_notify(struct proto *p, unsigned flags, struct ifa *a)
 
   struct radv_iface *ifa = radv_iface_find(ra, a->iface);
 
-  if (ifa)
-    radv_iface_notify(ifa, RA_EV_CHANGE);
+  if (!ifa || !ifa->sk)
+    return;
+
+  if (flags & IF_CHANGE_DOWN)
+    radv_prefix_withdraw(ifa, a);
+  else if (flags & IF_CHANGE_UP)
+    radv_prefix_restore(ifa, a);
+
+  radv_iface_notify(ifa, RA_EV_CHANGE);
 }
 
 static struct proto *
@@ -303,6 +407,7 @@ radv_reconfigure(struct proto *p, struct proto_config *c)
     if (ifa && ic)
     {
       ifa->cf = ic;
+      radv_flush_opts(ifa);
 
       /* We cheat here - always notify the change even if there isn't
 	 any. That would leads just to a few unnecessary RAs. */
@@ -335,6 +440,23 @@ radv_copy_config(struct proto_config *dest, struct proto_config *src)
   cfg_copy_list(&d->pref_list, &s->pref_list, sizeof(struct radv_prefix_config));
 }
 
+static void
+radv_show_proto_info(struct proto *p)
+{
+  struct proto_radv *ra = (struct proto_radv *) p;
+  struct radv_iface *ifa;
+
+  proto_show_basic_info(p);
+
+  if (p->proto_state != PS_UP)
+    return;
+
+  cli_msg(-1006, "  Interface stats:   RS received    RA sent  RS coalesced");
+  WALK_LIST(ifa, ra->iface_list)
+    cli_msg(-1006, "    %-16s %11u %10u %13u", ifa->iface->name,
+	    ifa->rs_received, ifa->ra_sent, ifa->rs_coalesced);
+}
+
 
 struct protocol proto_radv = {
   .name =		"RAdv",
@@ -343,5 +465,6 @@ struct protocol proto_radv = {
   .start =		radv_start,
   .shutdown =		radv_shutdown,
   .reconfigure =	radv_reconfigure,
-  .copy_config =	radv_copy_config
+  .copy_config =	radv_copy_config,
+  .show_proto_info =	radv_show_proto_info
 };
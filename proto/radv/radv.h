@@ -130,6 +130,23 @@ struct radv_iface
   bird_clock_t last;		/* Time of last sending of RA */
   u16 plen;			/* Length of prepared RA in tbuf, or 0 if not valid */
   byte initial;			/* List of active ifaces */
+  list withdrawn;		/* Recently removed prefixes (struct radv_withdrawn) */
+  char *opts;			/* Prepared RDNSS and DNSSL options appended to RA */
+  int olen;			/* Length of opts, or -1 if not valid */
+
+  u32 rs_received;		/* Statistics */
+  u32 ra_sent;
+  u32 rs_coalesced;		/* RS answered by an already scheduled RA */
+};
+
+struct radv_withdrawn
+{
+  node n;
+  ip_addr prefix;
+  int pxlen;
+  u8 onlink;			/* Flags of the prefix option as last announced */
+  u8 autonomous;
+  u8 remains;			/* Number of RAs still carrying the zero lifetimes */
 };
 
 #define RA_EV_INIT 1		/* Switch to initial mode */
@@ -151,7 +168,9 @@ struct radv_iface
 void radv_iface_notify(struct radv_iface *ifa, int event);
 
 /* packets.c */
+struct radv_prefix_config *radv_prefix_match(struct radv_iface *ifa, struct ifa *a);
 int radv_process_domain(struct radv_dnssl_config *cf);
+void radv_flush_opts(struct radv_iface *ifa);
 void radv_send_ra(struct radv_iface *ifa, int shutdown);
 int radv_sk_open(struct radv_iface *ifa);
 
@@ -6,7 +6,6 @@
  *
  *	Can be freely distributed and used under the terms of the GNU GPL.
  *
- 	FIXME: IpV6 support: packet size
 	FIXME: (nonurgent) IpV6 support: receive "route using" blocks
 	FIXME: (nonurgent) IpV6 support: generate "nexthop" blocks
 		next hops are only advisory, and they are pretty ugly in IpV6.
@@ -30,7 +29,9 @@
  * and waits for the core to call rip_rt_notify().
  *
  * Within rip_tx(), the list is
- * walked and a packet is generated using rip_tx_prepare(). This gets
+ * walked and a packet is generated using rip_tx_prepare(). RIPng packets
+ * are filled up to the MTU of the interface, RIPv2 ones are limited to
+ * 512 bytes as the RFC says (see rip_tx_blocks()). This gets
  * tricky because we may need to send more than one packet to one
  * destination. Struct &rip_connection is used to hold context information such as how
  * many of &rip_entry's we have already sent and it's also used to protect
@@ -42,8 +43,14 @@
  *
  * About triggered updates, RFC says: when a triggered update was sent,
  * don't send a new one for something between 1 and 5 seconds (and send one
- * after that). We do something else: each 5 seconds,
- * we look for any changed routes and broadcast them.
+ * after that). rip_rt_notify() queues changed entries and starts a timer
+ * for a random time in this range unless it is already running. When it
+ * fires, rip_trigger() takes a snapshot of the queue (&rip_update) and
+ * sends just these entries to all interfaces.
+ *
+ * Our routes in the core table are kept in lists ordered by the time of
+ * their last refresh, so timeouts are handled by looking at the heads of
+ * the lists only.
  */
 
 #undef LOCAL_DEBUG
@@ -124,6 +131,48 @@ rip_tx_prepare(struct proto *p, struct rip_block *b, struct rip_entry *e, struct
   return pos+1;
 }
 
+/*
+ * rip_tx_blocks - number of blocks (including the authentication one)
+ * fitting into one packet sent to @rif. The MD5 trailer is not counted.
+ */
+static int
+rip_tx_blocks(struct proto *p, struct rip_interface *rif)
+{
+  unsigned mtu = (rif->iface && rif->iface->mtu > RIP_MIN_MTU) ? rif->iface->mtu : RIP_MIN_MTU;
+  int n = (mtu - SIZE_OF_IP_HEADER - SIZE_OF_UDP_HEADER - sizeof(struct rip_packet_heading)) /
+    sizeof(struct rip_block);
+
+  if (P_CF->authtype == AT_MD5)
+    n = MIN(n - 1, PACKET_MD5_MAX);
+  return MIN(n, PACKET_BLOCKS);
+}
+
+/*
+ * rip_tx_buffer - (re)allocate transmit buffer of @rif according to
+ * its current MTU
+ */
+static void
+rip_tx_buffer(struct proto *p, struct rip_interface *rif)
+{
+  int n = rip_tx_blocks(p, rif);
+
+  if (n == rif->tx_blocks)
+    return;
+
+  if (rif->sock->tbuf)
+    mb_free(rif->sock->tbuf);
+  rif->sock->tbuf = mb_alloc(p->pool, sizeof(struct rip_packet_heading) +
+			     (n + 1) * sizeof(struct rip_block)); /* One more for MD5 trailer */
+  rif->tx_blocks = n;
+}
+
+static inline void
+rip_update_unlock(struct rip_update *u)
+{
+  if (!--u->uc)
+    mb_free(u);
+}
+
 /*
  * rip_tx - send one rip packet to the network
  */
@@ -135,7 +184,7 @@ rip_tx( sock *s )
   struct proto *p = c->proto;
   struct rip_packet *packet = (void *) s->tbuf;
   int i, packetlen;
-  int maxi, nullupdate = 1;
+  int maxi, nullupdate;
 
   DBG( "Sending to %I\n", s->daddr );
   do {
@@ -143,6 +192,8 @@ rip_tx( sock *s )
     if (c->done)
       goto done;
 
+    nullupdate = 1;
+
     DBG( "Preparing packet to send: " );
 
     packet->heading.command = RIPCMD_RESPONSE;
@@ -154,24 +205,33 @@ rip_tx( sock *s )
     packet->heading.unused  = 0;
 
     i = !!P_CF->authtype;
-#ifndef IPV6
-    maxi = ((P_CF->authtype == AT_MD5) ? PACKET_MD5_MAX : PACKET_MAX);
-#else
-    maxi = 5; /* We need to have at least reserve of one at end of packet */
-#endif
+    maxi = rif->tx_blocks;
 
-    FIB_ITERATE_START(&P->rtable, &c->iter, z) {
-      struct rip_entry *e = (struct rip_entry *) z;
+    if (c->update) {
+      /* Triggered update, entries may have disappeared meanwhile */
+      while (c->pos < c->update->count) {
+	struct rip_update_px *px = &c->update->px[c->pos++];
+	struct rip_entry *e = fib_find( &P->rtable, &px->prefix, px->pxlen );
+
+	if (!e)
+	  continue;
+	nullupdate = 0;
+	i = rip_tx_prepare( p, packet->block + i, e, rif, i );
+	if (i >= maxi)
+	  goto break_loop;
+      }
+    } else {
+      FIB_ITERATE_START(&P->rtable, &c->iter, z) {
+	struct rip_entry *e = (struct rip_entry *) z;
 
-      if (!rif->triggered || (!(e->updated < now-5))) {
 	nullupdate = 0;
 	i = rip_tx_prepare( p, packet->block + i, e, rif, i );
 	if (i >= maxi) {
 	  FIB_ITERATE_PUT(&c->iter, z);
 	  goto break_loop;
 	}
-      }
-    } FIB_ITERATE_END(z);
+      } FIB_ITERATE_END(z);
+    }
     c->done = 1;
 
   break_loop:
@@ -188,6 +248,11 @@ rip_tx( sock *s )
       i = sk_send_to( s, packetlen, c->daddr, c->dport );
     else
       i = sk_send( s, packetlen );
+    if (i >= 0) {
+      c->packets++;
+      c->bytes += packetlen;
+      p->perf.tx_packets++;
+    }
 
     DBG( "it wants more\n" );
 
@@ -199,6 +264,14 @@ rip_tx( sock *s )
 
 done:
   DBG( "Looks like I'm" );
+  if (c->packets)
+    TRACE(D_PACKETS, "Sent %d packets (%d bytes) to %s", c->packets, c->bytes, rif->iface ? rif->iface->name : "(dummy)" );
+  if (!ipa_nonzero(c->daddr)) {
+    rif->tx_packets = c->packets;
+    rif->tx_bytes = c->bytes;
+  }
+  if (c->update)
+    rip_update_unlock(c->update);
   c->rif->busy = NULL;
   rem_node(NODE c);
   mb_free(c);
@@ -210,9 +283,10 @@ done:
  * rip_sendto - send whole routing table to selected destination
  * @rif: interface to use. Notice that we lock interface so that at
  * most one send to one interface is done.
+ * @u: send only entries of this triggered update, %NULL for whole table
  */
 static void
-rip_sendto( struct proto *p, ip_addr daddr, int dport, struct rip_interface *rif )
+rip_sendto( struct proto *p, ip_addr daddr, int dport, struct rip_interface *rif, struct rip_update *u )
 {
   struct iface *iface = rif->iface;
   struct rip_connection *c;
@@ -236,9 +310,18 @@ rip_sendto( struct proto *p, ip_addr daddr, int dport, struct rip_interface *rif
     bug("not enough send magic");
 
   c->done = 0;
-  FIB_ITERATE_INIT( &c->iter, &P->rtable );
+  c->packets = c->bytes = 0;
+  rip_tx_buffer(p, rif);
+  c->update = u;
+  c->pos = 0;
+  if (u)
+    u->uc++;
+  else
+    FIB_ITERATE_INIT( &c->iter, &P->rtable );
   add_head( &P->connections, NODE c );
-  if (ipa_nonzero(daddr))
+  if (u)
+    TRACE(D_PACKETS, "Sending triggered update (%d entries) to %s", u->count, rif->iface->name );
+  else if (ipa_nonzero(daddr))
     TRACE(D_PACKETS, "Sending my routing table to %I:%d on %s", daddr, dport, rif->iface->name );
   else
     TRACE(D_PACKETS, "Broadcasting routing table to %s", rif->iface->name );
@@ -412,7 +495,7 @@ rip_process_packet( struct proto *p, struct rip_packet *packet, int num, ip_addr
 
 	  if ((P_CF->honor == HO_NEIGHBOR) && (!neigh_find2( p, &whotoldme, iface, 0 )))
 	    BAD( "They asked me to send routing table, but he is not my neighbor" );
-    	  rip_sendto( p, whotoldme, port, HEAD(P->interfaces) ); /* no broadcast */
+    	  rip_sendto( p, whotoldme, port, HEAD(P->interfaces), NULL ); /* no broadcast */
           break;
   case RIPCMD_RESPONSE: DBG( "*** Rtable from %I\n", whotoldme );
           if (port != P_CF->port) {
@@ -483,11 +566,12 @@ rip_rx(sock *s, int size)
 
   CHK_MAGIC;
   DBG( "RIP: message came: %d bytes from %I via %s\n", size, s->faddr, i->iface ? i->iface->name : "(dummy)" );
+  p->perf.rx_packets++;
   size -= sizeof( struct rip_packet_heading );
   if (size < 0) BAD( "Too small packet" );
   if (size % sizeof( struct rip_block )) BAD( "Odd sized packet" );
   num = size / sizeof( struct rip_block );
-  if (num>PACKET_MAX) BAD( "Too many blocks" );
+  if (num>PACKET_BLOCKS) BAD( "Too many blocks" );
 
   if (ipa_equal(i->iface->addr->ip, s->faddr)) {
     DBG("My own packet\n");
@@ -510,6 +594,25 @@ rip_dump_entry( struct rip_entry *e )
   debug( "\n" );
 }
 
+/*
+ * rip_garbage_queue - put @rte to @l, keeping it ordered by time of
+ * the last refresh. Routes are almost always refreshed just now, so
+ * the walk from the tail is short.
+ */
+static void
+rip_garbage_queue(list *l, rte *rte)
+{
+  node *n;
+
+  rte->u.rip.queued = rte->lastmod;
+  WALK_LIST_BACKWARDS(n, *l)
+    if (SKIP_BACK(struct rte, u.rip.garbage, n)->u.rip.queued <= rte->u.rip.queued) {
+      insert_node( &rte->u.rip.garbage, n );
+      return;
+    }
+  add_head( l, &rte->u.rip.garbage );
+}
+
 /**
  * rip_timer
  * @t: timer
@@ -517,47 +620,59 @@ rip_dump_entry( struct rip_entry *e )
  * Broadcast routing tables periodically (using rip_tx) and kill
  * routes that are too old. RIP keeps a list of its own entries present
  * in the core table by a linked list (functions rip_rte_insert() and
- * rip_rte_delete() are responsible for that), it walks this list in the timer
- * and in case an entry is too old, it is discarded.
+ * rip_rte_delete() are responsible for that). The list is ordered by
+ * the time of the last refresh of the routes, so the timer looks only
+ * at its head. Routes which timed out are moved to another list and
+ * discarded when they are too old even for that.
  */
 
 static void
 rip_timer(timer *t)
 {
   struct proto *p = t->data;
-  struct fib_node *e, *et;
+  node *n, *nn;
+  rte *rte;
 
   CHK_MAGIC;
   DBG( "RIP: tick tock\n" );
 
-  WALK_LIST_DELSAFE( e, et, P->garbage ) {
-    rte *rte;
-    rte = SKIP_BACK( struct rte, u.rip.garbage, e );
-#ifdef LOCAL_DEBUG
-    {
-      struct proto *p = rte->attrs->proto;
-      CHK_MAGIC;
-    }
-    DBG( "Garbage: (%p)", rte ); rte_dump( rte );
-#endif
+  WALK_LIST_DELSAFE( n, nn, P->garbage ) {
+    rte = SKIP_BACK( struct rte, u.rip.garbage, n );
+    if (now - (bird_clock_t) rte->u.rip.queued <= P_CF->timeout_time)
+      break;
+    DBG( "Garbage: (%p)", rte );
 
+    rem_node( &rte->u.rip.garbage );
     if (now - rte->lastmod > P_CF->timeout_time) {
       TRACE(D_EVENTS, "entry is too old: %I", rte->net->n.prefix );
       if (rte->u.rip.entry) {
 	rte->u.rip.entry->metric = P_CF->infinity;
 	rte->u.rip.metric = P_CF->infinity;
       }
+      rip_garbage_queue( &P->expired, rte );
     }
+    else
+      rip_garbage_queue( &P->garbage, rte );	/* Refreshed meanwhile */
+  }
+
+  WALK_LIST_DELSAFE( n, nn, P->expired ) {
+    rte = SKIP_BACK( struct rte, u.rip.garbage, n );
+    if (now - (bird_clock_t) rte->u.rip.queued <= P_CF->garbage_time)
+      break;
 
     if (now - rte->lastmod > P_CF->garbage_time) {
       TRACE(D_EVENTS, "entry is much too old: %I", rte->net->n.prefix );
       rte_discard(p->table, rte);
+    } else {
+      rem_node( &rte->u.rip.garbage );
+      rip_garbage_queue( &P->garbage, rte );
     }
   }
 
-  DBG( "RIP: Broadcasting routing tables\n" );
-  {
+  if (!(P->tx_count++ % 6)) {
     struct rip_interface *rif;
+
+    DBG( "RIP: Broadcasting routing tables\n" );
     WALK_LIST( rif, P->interfaces ) {
       struct iface *iface = rif->iface;
 
@@ -565,15 +680,65 @@ rip_timer(timer *t)
       if (rif->mode & IM_QUIET) continue;
       if (!(iface->flags & IF_UP)) continue;
 
-      rif->triggered = (P->tx_count % 6);
-      rip_sendto( p, IPA_NONE, 0, rif );
+      rip_sendto( p, IPA_NONE, 0, rif, NULL );
     }
-    P->tx_count ++;
   }
 
   DBG( "RIP: tick tock done\n" );
 }
 
+/**
+ * rip_trigger
+ * @t: timer
+ *
+ * Send a triggered update with all entries changed since the last one.
+ * The timer is started by rip_rt_notify(), so the next triggered update
+ * is sent 1 to 5 seconds after a change following this one at the soonest.
+ */
+static void
+rip_trigger(timer *t)
+{
+  struct proto *p = t->data;
+  struct rip_interface *rif;
+  struct rip_entry *e;
+  struct rip_update *u;
+  node *n;
+  int count = 0;
+
+  CHK_MAGIC;
+  WALK_LIST(n, P->changed)
+    count++;
+  if (!count)
+    return;
+
+  u = mb_alloc(p->pool, sizeof(struct rip_update) + count * sizeof(struct rip_update_px));
+  u->uc = 1;
+  u->count = 0;
+  WALK_LIST(n, P->changed) {
+    e = SKIP_BACK(struct rip_entry, dn, n);
+    u->px[u->count].prefix = e->n.prefix;
+    u->px[u->count].pxlen = e->n.pxlen;
+    u->count++;
+    e->flags &= ~RIP_EF_CHANGED;
+  }
+  init_list(&P->changed);
+
+  if (P->update)
+    rip_update_unlock(P->update);
+  P->update = u;
+
+  WALK_LIST( rif, P->interfaces ) {
+    struct iface *iface = rif->iface;
+
+    if (!iface) continue;
+    if (rif->mode & IM_QUIET) continue;
+    if (!(iface->flags & IF_UP)) continue;
+    if (rif->busy) continue;	/* It will get the next periodic update */
+
+    rip_sendto( p, IPA_NONE, 0, rif, u );
+  }
+}
+
 /*
  * rip_start - initialize instance of rip
  */
@@ -593,13 +758,20 @@ rip_start(struct proto *p)
   fib_init( &P->rtable, p->pool, sizeof( struct rip_entry ), 0, NULL );
   init_list( &P->connections );
   init_list( &P->garbage );
+  init_list( &P->expired );
+  init_list( &P->changed );
   init_list( &P->interfaces );
+  P->update = NULL;
   P->timer = tm_new( p->pool );
   P->timer->data = p;
   P->timer->randomize = 5;
   P->timer->recurrent = (P_CF->period / 6)+1;
   P->timer->hook = rip_timer;
   tm_start( P->timer, 5 );
+  P->trigger_timer = tm_new( p->pool );
+  P->trigger_timer->data = p;
+  P->trigger_timer->randomize = 4;
+  P->trigger_timer->hook = rip_trigger;
   rif = new_iface(p, NULL, 0, NULL);	/* Initialize dummy interface */
   add_head( &P->interfaces, NODE rif );
   CHK_MAGIC;
@@ -637,7 +809,7 @@ rip_dump(struct proto *p)
   } FIB_WALK_END;
   i = 0;
   WALK_LIST( rif, P->interfaces ) {
-    debug( "RIP: interface #%d: %s, %I, busy = %x\n", i++, rif->iface?rif->iface->name:"(dummy)", rif->sock->daddr, rif->busy );
+    debug( "RIP: interface #%d: %s, %I, busy = %x, last update %d packets (%d bytes)\n", i++, rif->iface?rif->iface->name:"(dummy)", rif->sock->daddr, rif->busy, rif->tx_packets, rif->tx_bytes );
   }
 }
 
@@ -656,6 +828,7 @@ static void
 kill_iface(struct rip_interface *i)
 {
   DBG( "RIP: Interface %s disappeared\n", i->iface->name);
+  mb_free(i->sock->tbuf);
   rfree(i->sock);
   mb_free(i);
 }
@@ -696,9 +869,9 @@ new_iface(struct proto *p, struct iface *new, unsigned long flags, struct iface_
   rif->sock->sport = P_CF->port;
   rif->sock->rx_hook = rip_rx;
   rif->sock->data = rif;
-  rif->sock->rbsize = 10240;
+  rif->sock->rbsize = RIP_RX_BUFFER;
   rif->sock->iface = new;		/* Automagically works for dummy interface */
-  rif->sock->tbuf = mb_alloc( p->pool, sizeof( struct rip_packet ));
+  rip_tx_buffer(p, rif);
   rif->sock->tx_hook = rip_tx;
   rif->sock->err_hook = rip_tx_err;
   rif->sock->daddr = IPA_NONE;
@@ -754,6 +927,7 @@ new_iface(struct proto *p, struct iface *new, unsigned long flags, struct iface_
  err:
   log( L_ERR "%s: could not create socket for %s", p->name, rif->iface ? rif->iface->name : "(dummy)" );
   if (rif->iface) {
+    mb_free(rif->sock->tbuf);
     rfree(rif->sock);
     mb_free(rif);
     return NULL;
@@ -879,8 +1053,11 @@ rip_rt_notify(struct proto *p, struct rtable *table UNUSED, struct network *net,
   struct rip_entry *e;
 
   e = fib_find( &P->rtable, &net->n.prefix, net->n.pxlen );
-  if (e)
+  if (e) {
+    if (e->flags & RIP_EF_CHANGED)
+      rem_node( &e->dn );
     fib_delete( &P->rtable, e );
+  }
 
   if (new) {
     e = fib_get( &P->rtable, &net->n.prefix, net->n.pxlen );
@@ -902,7 +1079,10 @@ rip_rt_notify(struct proto *p, struct rtable *table UNUSED, struct network *net,
 			   routes in rip. */
       e->metric = 5;
     e->updated = e->changed = now;
-    e->flags = 0;
+    e->flags = RIP_EF_CHANGED;
+    add_tail( &P->changed, &e->dn );
+    if (!P->trigger_timer->expires)
+      tm_start( P->trigger_timer, 1 );
   }
 }
 
@@ -947,7 +1127,7 @@ rip_rte_insert(net *net UNUSED, rte *rte)
   struct proto *p = rte->attrs->proto;
   CHK_MAGIC;
   DBG( "rip_rte_insert: %p\n", rte );
-  add_head( &P->garbage, &rte->u.rip.garbage );
+  rip_garbage_queue( &P->garbage, rte );
 }
 
 /*
@@ -11,8 +11,20 @@
 #define EA_RIP_TAG	EA_CODE(EAP_RIP, 0)
 #define EA_RIP_METRIC	EA_CODE(EAP_RIP, 1)
 
-#define PACKET_MAX	25
+#define PACKET_MAX	25	/* RIPv2 packets are limited to 512 bytes */
 #define PACKET_MD5_MAX	18	/* FIXME */
+#define PACKET_NG_MAX	500	/* RIPng packets are limited by MTU only, keep them within RIP_RX_BUFFER */
+
+#ifndef IPV6
+#define PACKET_BLOCKS	PACKET_MAX
+#define RIP_MIN_MTU	576
+#else
+#define PACKET_BLOCKS	PACKET_NG_MAX
+#define RIP_MIN_MTU	1280
+#endif
+
+#define RIP_RX_BUFFER	10240
+#define SIZE_OF_UDP_HEADER 8
 
 
 #define RIP_V1		1
@@ -38,6 +50,18 @@ struct rip_connection {
   ip_addr daddr;
   int dport;
   int done;
+  int packets, bytes;		/* Sent so far */
+  struct rip_update *update;	/* Entries to send in triggered update, NULL for full update */
+  int pos;			/* Position in update */
+};
+
+struct rip_update {		/* Prefixes changed since the last triggered update */
+  unsigned uc;			/* Use count */
+  int count;
+  struct rip_update_px {
+    ip_addr prefix;
+    int pxlen;
+  } px[0];
 };
 
 struct rip_packet_heading {		/* 4 bytes */
@@ -91,6 +115,7 @@ struct rip_md5_tail {	/* 20 bytes */
 
 struct rip_entry {
   struct fib_node n;
+  node dn;				/* Node in list of changed entries */
 
   ip_addr whotoldme;
   ip_addr nexthop;
@@ -99,11 +124,12 @@ struct rip_entry {
 
   bird_clock_t updated, changed;
   int flags;
+#define RIP_EF_CHANGED 1		/* Queued in rip_proto->changed */
 };
 
 struct rip_packet {
   struct rip_packet_heading heading;
-  struct rip_block block[PACKET_MAX];
+  struct rip_block block[PACKET_BLOCKS];
 };
 
 struct rip_interface {
@@ -114,9 +140,10 @@ struct rip_interface {
   struct rip_connection *busy;
   int metric;			/* You don't want to put struct rip_patt *patt here -- think about reconfigure */
   int mode;
-  int triggered;
   struct object_lock *lock;
   int multicast;
+  int tx_blocks;		/* Blocks per packet tbuf is allocated for */
+  int tx_packets, tx_bytes;	/* Sent in the last update cycle */
 };
 
 struct rip_patt {
@@ -154,9 +181,13 @@ struct rip_proto_config {
 struct rip_proto {
   struct proto inherited;
   timer *timer;
+  timer *trigger_timer;	/* Rate limiting of triggered updates */
   list connections;
   struct fib rtable;
-  list garbage;
+  list garbage;		/* Our routes ordered by their last refresh */
+  list expired;		/* Timed out routes waiting for garbage collection, ditto */
+  list changed;		/* Entries changed since the last triggered update */
+  struct rip_update *update;	/* The last triggered update */
   list interfaces;	/* Interfaces we really know about */
 #ifdef LOCAL_DEBUG
   int magic;
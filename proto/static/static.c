@@ -31,7 +31,16 @@
  * The only other thing worth mentioning is that when asked for reconfiguration,
  * Static not only compares the two configurations, but it also calculates
  * difference between the lists of static routes and it just inserts the
- * newly added routes and removes the obsolete ones.
+ * newly added routes and removes the obsolete ones. To keep this linear
+ * even for huge route lists, the configured routes are indexed by prefix
+ * in a FIB (built by static_postconfig()), so each old route finds its
+ * counterpart in the new configuration by a single lookup.
+ *
+ * Besides the configured routes, routes may be added and removed from
+ * the CLI (static_add_dynamic() and static_delete_dynamic()) without a
+ * reconfiguration. These dynamic routes are kept in a separate list
+ * and FIB of &static_proto until the protocol is restarted. A configured
+ * route always takes precedence over a dynamic route for the same prefix.
  */
 
 #undef LOCAL_DEBUG
@@ -47,6 +56,20 @@
 
 #include "static.h"
 
+static void
+static_index_init(struct fib_node *N)
+{
+  struct static_index *i = (struct static_index *) N;
+  i->route = NULL;
+}
+
+static inline struct static_route *
+static_find(struct fib *f, ip_addr net, int masklen)
+{
+  struct static_index *i = fib_find(f, &net, masklen);
+  return i ? i->route : NULL;
+}
+
 static inline rtable *
 p_igp_table(struct proto *p)
 {
@@ -216,6 +239,7 @@ static_add(struct proto *p, struct static_config *cf, struct static_route *r)
 static int
 static_start(struct proto *p)
 {
+  struct static_proto *sp = (struct static_proto *) p;
   struct static_config *cf = (void *) p->cf;
   struct static_route *r;
 
@@ -224,6 +248,9 @@ static_start(struct proto *p)
   if (cf->igp_table)
     rt_lock_table(cf->igp_table->table);
 
+  init_list(&sp->dynamic_routes);
+  fib_init(&sp->dynamic_index, p->pool, sizeof(struct static_index), 0, static_index_init);
+
   /* We have to go UP before routes could be installed */
   proto_notify_state(p, PS_UP);
 
@@ -235,6 +262,7 @@ static_start(struct proto *p)
 static int
 static_shutdown(struct proto *p)
 {
+  struct static_proto *sp = (struct static_proto *) p;
   struct static_config *cf = (void *) p->cf;
   struct static_route *r;
 
@@ -244,6 +272,9 @@ static_shutdown(struct proto *p)
   WALK_LIST(r, cf->other_routes)
     r->installed = 0;
 
+  /* Dynamic routes are freed together with the protocol pool */
+  init_list(&sp->dynamic_routes);
+
   return PS_DOWN;
 }
 
@@ -331,6 +362,9 @@ static_dump(struct proto *p)
   debug("Device static routes:\n");
   WALK_LIST(r, c->iface_routes)
     static_dump_rt(r);
+  debug("Dynamic static routes:\n");
+  WALK_LIST(r, ((struct static_proto *) p)->dynamic_routes)
+    static_dump_rt(r);
 }
 
 static void
@@ -360,13 +394,40 @@ static_init_config(struct static_config *c)
   init_list(&c->other_routes);
 }
 
+static void
+static_index_routes(struct static_config *c, list *l)
+{
+  struct static_route *r;
+
+  WALK_LIST(r, *l)
+    {
+      struct static_index *i = fib_get(&c->index, &r->net, r->masklen);
+
+      /* For duplicate prefixes, the first route is used */
+      if (!i->route)
+	i->route = r;
+    }
+}
+
+static void
+static_postconfig(struct proto_config *C)
+{
+  struct static_config *c = (struct static_config *) C;
+
+  fib_init(&c->index, C->global->pool, sizeof(struct static_index), 0, static_index_init);
+  static_index_routes(c, &c->iface_routes);
+  static_index_routes(c, &c->other_routes);
+}
+
 static struct proto *
 static_init(struct proto_config *c)
 {
-  struct proto *p = proto_new(c, sizeof(struct proto));
+  struct proto *p = proto_new(c, sizeof(struct static_proto));
+  struct static_proto *sp = (struct static_proto *) p;
 
   p->neigh_notify = static_neigh_notify;
   p->if_notify = static_if_notify;
+  init_list(&sp->dynamic_routes);
   return p;
 }
 
@@ -420,21 +481,47 @@ static_match(struct proto *p, struct static_route *r, struct static_config *n)
 
   if (r->neigh)
     r->neigh->data = NULL;
-  WALK_LIST(t, n->iface_routes)
-    if (static_same_net(r, t))
-      {
-	t->installed = r->installed && static_same_dest(r, t);
-	return;
-      }
-  WALK_LIST(t, n->other_routes)
-    if (static_same_net(r, t))
-      {
-	t->installed = r->installed && static_same_dest(r, t);
-	return;
-      }
+  t = static_find(&n->index, r->net, r->masklen);
+  if (t)
+    {
+      t->installed = r->installed && static_same_dest(r, t);
+      return;
+    }
   static_remove(p, r);
 }
 
+static void
+static_unchain(struct static_route *r)
+{
+  struct neighbor *n = r->neigh;
+  struct static_route *x;
+
+  if (!n)
+    return;
+
+  if (n->data == r)
+    n->data = r->chain;
+  else
+    for (x = n->data; x; x = x->chain)
+      if (x->chain == r)
+	{
+	  x->chain = r->chain;
+	  break;
+	}
+}
+
+static void
+static_drop_dynamic(struct proto *p, struct static_route *r)
+{
+  struct static_proto *sp = (struct static_proto *) p;
+
+  static_unchain(r);
+  static_remove(p, r);
+  rem_node(&r->n);
+  fib_delete(&sp->dynamic_index, fib_find(&sp->dynamic_index, &r->net, r->masklen));
+  mb_free(r);
+}
+
 static inline rtable *
 cf_igp_table(struct static_config *cf)
 {
@@ -444,9 +531,10 @@ cf_igp_table(struct static_config *cf)
 static int
 static_reconfigure(struct proto *p, struct proto_config *new)
 {
+  struct static_proto *sp = (struct static_proto *) p;
   struct static_config *o = (void *) p->cf;
   struct static_config *n = (void *) new;
-  struct static_route *r;
+  struct static_route *r, *rn;
 
   if (cf_igp_table(o) != cf_igp_table(n))
     return 0;
@@ -456,6 +544,18 @@ static_reconfigure(struct proto *p, struct proto_config *new)
     static_match(p, r, n);
   WALK_LIST(r, o->other_routes)
     static_match(p, r, n);
+  WALK_LIST(r, sp->dynamic_routes)
+    if (r->neigh)
+      r->neigh->data = NULL;
+
+  /* Dynamic routes are superseded by newly configured ones */
+  WALK_LIST_DELSAFE(r, rn, sp->dynamic_routes)
+    if (static_find(&n->index, r->net, r->masklen))
+      {
+	log(L_WARN "%s: Dynamic route %I/%d replaced by configured one",
+	    p->name, r->net, r->masklen);
+	static_drop_dynamic(p, r);
+      }
 
   /* Now add all new routes, those not changed will be ignored by static_install() */
   WALK_LIST(r, n->iface_routes)
@@ -466,6 +566,8 @@ static_reconfigure(struct proto *p, struct proto_config *new)
     }
   WALK_LIST(r, n->other_routes)
     static_add(p, n, r);
+  WALK_LIST(r, sp->dynamic_routes)
+    static_add(p, n, r);
 
   return 1;
 }
@@ -526,6 +628,7 @@ struct protocol proto_static = {
   name:		"Static",
   template:	"static%d",
   preference:	DEF_PREF_STATIC,
+  postconfig:	static_postconfig,
   init:		static_init,
   dump:		static_dump,
   start:	static_start,
@@ -570,5 +673,103 @@ static_show(struct proto *P)
     static_show_rt(r);
   WALK_LIST(r, c->iface_routes)
     static_show_rt(r);
+  WALK_LIST(r, ((struct static_proto *) P)->dynamic_routes)
+    static_show_rt(r);
   cli_msg(0, "");
 }
+
+/**
+ * static_add_dynamic - add routes from CLI
+ * @P: static protocol instance
+ * @routes: list of routes (struct static_route) parsed from CLI
+ *
+ * This function adds the @routes to dynamic routes of @P, replacing
+ * dynamic routes for the same prefixes. Only routes whose destination
+ * changed are announced. Routes for prefixes which are configured are
+ * ignored.
+ */
+void
+static_add_dynamic(struct proto *P, list *routes)
+{
+  struct static_proto *sp = (struct static_proto *) P;
+  struct static_config *cf = (void *) P->cf;
+  struct static_route *r, *nr, *old;
+  int added = 0, ignored = 0;
+
+  if (P->proto_state != PS_UP)
+    {
+      cli_msg(8008, "%s: Protocol is down", P->name);
+      return;
+    }
+
+  WALK_LIST(r, *routes)
+    {
+      if (static_find(&cf->index, r->net, r->masklen))
+	{
+	  ignored++;
+	  continue;
+	}
+
+      struct static_index *i = fib_get(&sp->dynamic_index, &r->net, r->masklen);
+      old = i->route;
+
+      if (old && static_same_dest(old, r))
+	continue;
+
+      nr = mb_alloc(P->pool, sizeof(struct static_route));
+      memcpy(nr, r, sizeof(struct static_route));
+      nr->chain = NULL;
+      nr->neigh = NULL;
+      nr->installed = 0;
+      add_tail(&sp->dynamic_routes, &nr->n);
+      i->route = nr;
+
+      /* The new route replaces the old one in the table */
+      static_add(P, cf, nr);
+
+      if (old)
+	{
+	  static_unchain(old);
+	  if (!nr->installed)
+	    static_remove(P, old);
+	  rem_node(&old->n);
+	  mb_free(old);
+	}
+
+      added++;
+    }
+
+  cli_msg(17, "%s: %d routes added or changed, %d configured ones ignored",
+	  P->name, added, ignored);
+}
+
+/**
+ * static_delete_dynamic - remove routes from CLI
+ * @P: static protocol instance
+ * @routes: list of routes (struct static_route) with prefixes to remove
+ *
+ * This function removes dynamic routes of @P for the prefixes of
+ * @routes. Configured routes are not affected.
+ */
+void
+static_delete_dynamic(struct proto *P, list *routes)
+{
+  struct static_proto *sp = (struct static_proto *) P;
+  struct static_route *r, *old;
+  int deleted = 0;
+
+  if (P->proto_state != PS_UP)
+    {
+      cli_msg(8008, "%s: Protocol is down", P->name);
+      return;
+    }
+
+  WALK_LIST(r, *routes)
+    if (old = static_find(&sp->dynamic_index, r->net, r->masklen))
+      {
+	static_drop_dynamic(P, old);
+	deleted++;
+      }
+
+  cli_msg(17, "%s: %d routes deleted", P->name, deleted);
+}
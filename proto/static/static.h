@@ -15,6 +15,18 @@ struct static_config {
   list other_routes;		/* Routes hooked to neighbor cache and reject routes */
   int check_link;			/* Whether iface link state is used */
   struct rtable_config *igp_table;	/* Table used for recursive next hop lookups */
+  struct fib index;			/* Both lists indexed by prefix (struct static_index) */
+};
+
+struct static_proto {
+  struct proto p;
+  list dynamic_routes;			/* Routes added from CLI, kept until restart */
+  struct fib dynamic_index;		/* Dynamic routes indexed by prefix (struct static_index) */
+};
+
+struct static_index {
+  struct fib_node n;
+  struct static_route *route;
 };
 
 
@@ -41,5 +53,7 @@ struct static_route {
 #define RTDX_RECURSIVE 0x7f		/* Phony dest value for recursive routes */
 
 void static_show(struct proto *);
+void static_add_dynamic(struct proto *, list *);
+void static_delete_dynamic(struct proto *, list *);
 
 #endif
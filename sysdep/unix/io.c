@@ -32,11 +32,16 @@
 #include "lib/socket.h"
 #include "lib/event.h"
 #include "lib/string.h"
+#include "lib/perf.h"
 #include "nest/iface.h"
 
 #include "lib/unix.h"
 #include "lib/sysio.h"
 
+#ifdef HAVE_DLADDR
+#include <dlfcn.h>
+#endif
+
 /* Maximum number of calls of tx handler for one socket in one
  * select iteration. Should be small enough to not monopolize CPU by
  * one protocol instance.
@@ -62,6 +67,7 @@ rf_free(resource *r)
 {
   struct rfile *a = (struct rfile *) r;
 
+  log_flush();				/* The file may have queued output */
   fclose(a->f);
 }
 
@@ -173,6 +179,45 @@ update_times(void)
     update_times_plain();
 }
 
+/**
+ * current_time_usec - get precise time
+ *
+ * Returns monotonic time in microseconds (or real time, if the monotonic
+ * clock is not available). Unlike @now, it is not cached, so it is
+ * suitable for measuring durations of operations.
+ */
+u64
+current_time_usec(void)
+{
+  struct timespec ts;
+  struct timeval tv;
+
+  if (clock_monotonic_available && !clock_gettime(CLOCK_MONOTONIC, &ts))
+    return (u64) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+
+  gettimeofday(&tv, NULL);
+  return (u64) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/**
+ * current_time_nsec - get precise time in nanoseconds
+ *
+ * The same as current_time_usec(), but with nanosecond resolution
+ * (as far as the clock offers it).
+ */
+u64
+current_time_nsec(void)
+{
+  struct timespec ts;
+  struct timeval tv;
+
+  if (clock_monotonic_available && !clock_gettime(CLOCK_MONOTONIC, &ts))
+    return (u64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+  gettimeofday(&tv, NULL);
+  return (u64) tv.tv_sec * 1000000000 + (u64) tv.tv_usec * 1000;
+}
+
 static inline void
 init_times(void)
 {
@@ -375,7 +420,14 @@ tm_shot(void)
 	    i = 0;
 	  tm_start(t, i);
 	}
-      t->hook(t);
+      void (*hook)(struct timer *) = t->hook;
+      u64 start = perf_start();
+      u64 d;
+
+      hook(t);
+      d = current_time_nsec() - start;
+      perf_hist_add(&perf_timer_hist, d);
+      watchdog_check(WD_TIMER, hook, d);
     }
 }
 
@@ -560,11 +612,12 @@ sk_reallocate(sock *s)
   sk_alloc_bufs(s);
 }
 
+static char *sk_type_names[] = { "TCP<", "TCP>", "TCP", "UDP", "UDP/MC", "IP", "IP/MC", "MAGIC", "UNIX<", "UNIX", "DEL!" };
+
 static void
 sk_dump(resource *r)
 {
   sock *s = (sock *) r;
-  static char *sk_type_names[] = { "TCP<", "TCP>", "TCP", "UDP", "UDP/MC", "IP", "IP/MC", "MAGIC", "UNIX<", "UNIX", "DEL!" };
 
   debug("(%s, ud=%p, sa=%08x, sp=%d, da=%08x, dp=%d, tos=%d, ttl=%d, if=%s)\n",
 	sk_type_names[s->type],
@@ -1519,6 +1572,129 @@ sk_dump_all(void)
 #undef ERR
 #undef WARN
 
+/*
+ *	Watchdog
+ */
+
+static struct rate_limit rl_watchdog;
+
+static void
+watchdog_hook_name(char *buf, int size, void *hook)
+{
+#ifdef HAVE_DLADDR
+  Dl_info info;
+
+  if (dladdr(hook, &info) && info.dli_fname)
+    {
+      /* Static functions are not exported, so we usually get just an offset within the binary */
+      if (info.dli_sname && (info.dli_saddr == hook))
+	bsnprintf(buf, size, "%s", info.dli_sname);
+      else
+	{
+	  char *n = strrchr(info.dli_fname, '/');
+	  bsnprintf(buf, size, "%s+0x%lx", n ? n+1 : info.dli_fname,
+		    (unsigned long) ((char *) hook - (char *) info.dli_fbase));
+	}
+      return;
+    }
+#endif
+  bsnprintf(buf, size, "%p", hook);
+}
+
+/**
+ * watchdog_record - account a slow hook
+ * @kind: hook type (%WD_EVENT, %WD_TIMER, %WD_RX or %WD_TX)
+ * @hook: the hook function
+ * @d: how long the hook ran (in ns)
+ * @desc: optional description of the hook owner (e.g. a socket)
+ *
+ * This function is called by the main loop for each hook which has
+ * run longer than %WATCHDOG_MIN. It updates the table of the slowest
+ * hooks (keyed by @kind and @hook, the entry with the lowest maximum
+ * is replaced when the table is full) and if the hook has exceeded
+ * the |watchdog warning| limit, it logs a rate-limited warning naming
+ * the hook. As hooks are anonymous functions, they are named by their
+ * symbol or offset within the binary, which can be translated to the
+ * function name by addr2line(1).
+ */
+void
+watchdog_record(unsigned kind, void *hook, u64 d, char *desc)
+{
+  struct watchdog_entry *e, *min = NULL;
+  unsigned limit = config ? config->watchdog_warning : 0;
+  char name[WATCHDOG_NAME_SIZE];
+  int i;
+
+  for (i = 0; i < WATCHDOG_SLOTS; i++)
+    {
+      e = &watchdog_top[i];
+      if (e->hook == hook && e->kind == kind)
+	goto found;
+      if (!min || (e->max < min->max))
+	min = e;
+    }
+  e = NULL;
+
+ found:
+  if (!e || (limit && (d >= limit * (u64) 1000000)))
+    {
+      int l;
+
+      watchdog_hook_name(name, sizeof(name), hook);
+      l = strlen(name);
+      if (desc && (bsnprintf(name + l, sizeof(name) - l, " (%s)", desc) < 0))
+	strcpy(name + sizeof(name) - 4, "...");
+    }
+
+  if (!e && (!min->hook || (d > min->max)))
+    {
+      e = min;
+      bzero(e, sizeof(struct watchdog_entry));
+      e->hook = hook;
+      e->kind = kind;
+      strcpy(e->name, name);
+    }
+
+  if (e)
+    {
+      e->count++;
+      e->time += d;
+      if (d > e->max)
+	{
+	  e->max = d;
+	  e->last = now;
+	}
+    }
+
+  if (limit && (d >= limit * (u64) 1000000))
+    log_rl(&rl_watchdog, L_WARN "Watchdog: %s hook %s ran for %u ms",
+	   watchdog_kind_names[kind], name, (unsigned) (d / 1000000));
+}
+
+static void
+sk_watchdog_check(unsigned kind, void *hook, sock *s, u64 start)
+{
+  u64 d = current_time_nsec() - start;
+  char desc[WATCHDOG_NAME_SIZE];
+
+  if (d < WATCHDOG_MIN)
+    return;
+
+  /* The socket may have been freed by the hook */
+  if (!s)
+    strcpy(desc, "closed socket");
+  else if (s->type >= SK_MAGIC)
+    bsnprintf(desc, sizeof(desc), "%s socket", sk_type_names[s->type]);
+  else if (ipa_zero(s->daddr))
+    bsnprintf(desc, sizeof(desc), "%s %I port %d%s%s", sk_type_names[s->type],
+	      s->saddr, s->sport, s->iface ? " on " : "", s->iface ? s->iface->name : "");
+  else
+    bsnprintf(desc, sizeof(desc), "%s %I port %d to %I port %d", sk_type_names[s->type],
+	      s->saddr, s->sport, s->daddr, s->dport);
+
+  watchdog_record(kind, hook, d, desc);
+}
+
 /*
  *	Main I/O Loop
  */
@@ -1551,8 +1727,11 @@ io_loop(void)
   int hi, events;
   sock *s;
   node *n;
+  u64 loop_start;
 
   sock_recalc_fdsets_p = 1;
+  log_init_async();
+  loop_start = perf_start();
   for(;;)
     {
       events = ev_run_list(&global_event_list);
@@ -1619,9 +1798,18 @@ io_loop(void)
 	  continue;
 	}
 
+      /* Write out messages queued so far */
+      log_flush();
+
+      perf_end(PERF_LOOP, loop_start);
+      loop_start = perf_start();
+
       /* And finally enter select() to find active sockets */
       hi = select(hi+1, &rd, &wr, NULL, &timo);
 
+      perf_end(PERF_POLL, loop_start);
+      loop_start = perf_start();
+
       if (hi < 0)
 	{
 	  if (errno == EINTR || errno == EAGAIN)
@@ -1639,12 +1827,18 @@ io_loop(void)
 	      int e;
 	      int steps;
 
+	      void *hook;
+	      u64 start;
+
 	      steps = MAX_STEPS;
 	      if ((s->type >= SK_MAGIC) && FD_ISSET(s->fd, &rd) && s->rx_hook)
 		do
 		  {
 		    steps--;
+		    hook = s->rx_hook;
+		    start = perf_start();
 		    e = sk_read(s);
+		    sk_watchdog_check(WD_RX, hook, (s == current_sock) ? s : NULL, start);
 		    if (s != current_sock)
 		      goto next;
 		  }
@@ -1655,7 +1849,10 @@ io_loop(void)
 		do
 		  {
 		    steps--;
+		    hook = s->tx_hook;
+		    start = perf_start();
 		    e = sk_write(s);
+		    sk_watchdog_check(WD_TX, hook, (s == current_sock) ? s : NULL, start);
 		    if (s != current_sock)
 		      goto next;
 		  }
@@ -1681,8 +1878,12 @@ io_loop(void)
 
 	      if ((s->type < SK_MAGIC) && FD_ISSET(s->fd, &rd) && s->rx_hook)
 		{
+		  void *hook = s->rx_hook;
+		  u64 start = perf_start();
+
 		  count++;
 		  e = sk_read(s);
+		  sk_watchdog_check(WD_RX, hook, (s == current_sock) ? s : NULL, start);
 		  if (s != current_sock)
 		      goto next2;
 		}
@@ -57,6 +57,7 @@
 #include "nest/protocol.h"
 #include "filter/filter.h"
 #include "lib/timer.h"
+#include "lib/perf.h"
 #include "conf/conf.h"
 #include "lib/string.h"
 
@@ -701,8 +702,11 @@ static void
 krt_prune(struct krt_proto *p)
 {
   struct rtable *t = p->p.table;
+  lp_state tmp_state;
+  u64 start = perf_start();
 
   KRT_TRACE(p, D_EVENTS, "Pruning table %s", t->name);
+  lp_save(krt_filter_lp, &tmp_state);
   FIB_WALK(&t->fib, f)
     {
       net *n = (net *) f;
@@ -759,16 +763,18 @@ krt_prune(struct krt_proto *p)
 	rte_free(old);
       if (new != new0)
 	rte_free(new);
-      lp_flush(krt_filter_lp);
+      lp_restore(krt_filter_lp, &tmp_state);
       f->flags &= ~KRF_VERDICT_MASK;
     }
   FIB_WALK_END;
+  lp_flush(krt_filter_lp);
 
 #ifdef KRT_ALLOW_LEARN
   if (KRT_CF->learn)
     krt_learn_prune(p);
 #endif
   p->initialized = 1;
+  perf_end(PERF_KRT_PRUNE, start);
 }
 
 void
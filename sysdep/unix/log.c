@@ -13,6 +13,15 @@
  * messages to system logs and to the debug output. Message classes
  * used by this module are described in |birdlib.h| and also in the
  * user's manual.
+ *
+ * Once the main loop is running, log messages are not written out
+ * immediately. log_commit() appends them to a queue which is flushed
+ * by log_flush() once per iteration of the main loop, so that a burst
+ * of tracing messages costs a single write per log file instead of
+ * a write and a flush per message. When the queue fills up, debugging
+ * and tracing messages are dropped (and the number of dropped messages
+ * is logged later), while more important messages force a synchronous
+ * flush. MRT dump messages are buffered in the same way.
  */
 
 #include <stdio.h>
@@ -20,6 +29,7 @@
 #include <stdarg.h>
 #include <time.h>
 #include <unistd.h>
+#include <string.h>
 
 #include "nest/bird.h"
 #include "nest/cli.h"
@@ -70,6 +80,27 @@ static char log_buffer[LOG_BUFFER_SIZE];
 static char *log_buffer_pos;
 static int log_buffer_remains;
 
+struct log_record {
+  bird_clock_t time;
+  u16 len;				/* Length of the whole record */
+  byte class;
+  char msg[0];
+};
+
+#define LOG_QUEUE_SIZE 65536
+#define LOG_QUEUE_RESERVE (LOG_QUEUE_SIZE / 8)	/* Kept free for important messages */
+static byte log_queue[LOG_QUEUE_SIZE] __attribute__((aligned(CPU_STRUCT_ALIGN)));
+static unsigned log_queue_len;
+static int log_async;
+
+unsigned log_dropped;			/* Total number of dropped messages */
+static unsigned log_dropped_pending;	/* Dropped messages not reported yet */
+
+#define MRT_QUEUE_SIZE 65536
+static byte mrt_queue[MRT_QUEUE_SIZE];
+static unsigned mrt_queue_len;
+static int mrt_queue_fd = -1;
+
 
 /**
  * log_reset - reset the log buffer
@@ -93,13 +124,14 @@ log_reset(void)
  * This function writes a message prepared in the log buffer to the
  * log file (as specified in the configuration). The log buffer is
  * reset after that. The log message is a full line, log_commit()
- * terminates it.
+ * terminates it. Unless the main loop has not been started yet, the
+ * message is only queued and written later by log_flush().
  *
  * The message class is an integer, not a first char of a string like
  * in log(), so it should be written like *L_INFO.
  */
-void
-log_commit(int class)
+static void
+log_write(int class, bird_clock_t time, char *msg)
 {
   struct log_config *l;
 
@@ -114,18 +146,120 @@ log_commit(int class)
 	  else
 	    {
 	      byte tbuf[TM_DATETIME_BUFFER_SIZE];
-	      tm_format_datetime(tbuf, &config->tf_log, now);
+	      tm_format_datetime(tbuf, &config->tf_log, time);
 	      fprintf(l->fh, "%s <%s> ", tbuf, class_names[class]);
 	    }
-	  fputs(log_buffer, l->fh);
+	  fputs(msg, l->fh);
 	  fputc('\n', l->fh);
-	  fflush(l->fh);
 	}
 #ifdef HAVE_SYSLOG
       else
-	syslog(syslog_priorities[class], "%s", log_buffer);
+	syslog(syslog_priorities[class], "%s", msg);
 #endif
     }
+}
+
+static void
+log_flush_files(void)
+{
+  struct log_config *l;
+
+  WALK_LIST(l, *current_log_list)
+    if (l->fh)
+      fflush(l->fh);
+}
+
+static void
+mrt_flush(void)
+{
+  if (mrt_queue_len)
+    write(mrt_queue_fd, mrt_queue, mrt_queue_len);
+  mrt_queue_len = 0;
+}
+
+/**
+ * log_flush - write out queued messages
+ *
+ * This function writes all log messages queued by log_commit()
+ * to the log files and syslog and all buffered MRT dump messages
+ * to the MRT dump file. It is called from the main loop, before
+ * reconfiguration and before the program terminates.
+ */
+void
+log_flush(void)
+{
+  unsigned pos = 0;
+
+  while (pos < log_queue_len)
+    {
+      struct log_record *r = (struct log_record *) (log_queue + pos);
+      log_write(r->class, r->time, r->msg);
+      pos += r->len;
+    }
+  log_queue_len = 0;
+
+  if (log_dropped_pending)
+    {
+      char buf[64];
+      bsprintf(buf, "... %u log messages dropped", log_dropped_pending);
+      log_write(L_WARN[0], now, buf);
+      log_dropped_pending = 0;
+    }
+
+  if (pos)
+    log_flush_files();
+
+  mrt_flush();
+}
+
+/**
+ * log_init_async - start queueing log messages
+ *
+ * Called when the main loop is entered. From now on, log messages
+ * are queued and written by log_flush().
+ */
+void
+log_init_async(void)
+{
+  log_async = 1;
+}
+
+static void
+log_enqueue(int class)
+{
+  unsigned len = BIRD_ALIGN(sizeof(struct log_record) + strlen(log_buffer) + 1, CPU_STRUCT_ALIGN);
+  unsigned avail = LOG_QUEUE_SIZE - log_queue_len;
+
+  if (class <= L_TRACE[0])
+    {
+      if (len + LOG_QUEUE_RESERVE > avail)
+	{
+	  log_dropped++;
+	  log_dropped_pending++;
+	  return;
+	}
+    }
+  else if (len > avail)
+    log_flush();
+
+  struct log_record *r = (struct log_record *) (log_queue + log_queue_len);
+  r->time = now;
+  r->len = len;
+  r->class = class;
+  strcpy(r->msg, log_buffer);
+  log_queue_len += len;
+}
+
+void
+log_commit(int class)
+{
+  if (log_async)
+    log_enqueue(class);
+  else
+    {
+      log_write(class, now, log_buffer);
+      log_flush_files();
+    }
   cli_echo(class, log_buffer);
 
   log_reset();
@@ -249,6 +383,7 @@ bug(char *msg, ...)
 
   va_start(args, msg);
   vlog(L_BUG[0], msg, args);
+  log_flush();
   abort();
 }
 
@@ -266,6 +401,7 @@ die(char *msg, ...)
 
   va_start(args, msg);
   vlog(L_FATAL[0], msg, args);
+  log_flush();
   exit(1);
 }
 
@@ -322,6 +458,8 @@ log_switch(int debug, list *l, char *new_syslog_name)
   if (!l || EMPTY_LIST(*l))
     l = default_log_list(debug, !l, &new_syslog_name);
 
+  if (current_log_list)
+    log_flush();
   current_log_list = l;
 
 #ifdef HAVE_SYSLOG
@@ -365,6 +503,20 @@ mrt_dump_message(struct proto *p, u16 type, u16 subtype, byte *buf, u32 len)
   put_u16(buf+6, subtype);
   put_u32(buf+8, len - MRTDUMP_HDR_LENGTH);
 
-  if (p->cf->global->mrtdump_file != -1)
-    write(p->cf->global->mrtdump_file, buf, len);
+  int fd = p->cf->global->mrtdump_file;
+  if (fd == -1)
+    return;
+
+  if ((fd != mrt_queue_fd) || (mrt_queue_len + len > MRT_QUEUE_SIZE))
+    mrt_flush();
+
+  if (!log_async || (len > MRT_QUEUE_SIZE))
+    {
+      write(fd, buf, len);
+      return;
+    }
+
+  memcpy(mrt_queue + mrt_queue_len, buf, len);
+  mrt_queue_fd = fd;
+  mrt_queue_len += len;
 }
@@ -429,6 +429,7 @@ sysdep_shutdown_done(void)
 {
   unlink(path_control_socket);
   log_msg(L_FATAL "Shutdown completed");
+  log_flush();
   exit(0);
 }
 
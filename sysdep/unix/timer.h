@@ -38,6 +38,9 @@ void tm_dump_all(void);
 extern bird_clock_t now; 		/* Relative, monotonic time in seconds */
 extern bird_clock_t now_real;		/* Time in seconds since fixed known epoch */
 
+u64 current_time_usec(void);		/* Precise monotonic time in microseconds, for statistics */
+u64 current_time_nsec(void);		/* The same in nanoseconds */
+
 static inline bird_clock_t
 tm_remains(timer *t)
 {
@@ -65,6 +65,7 @@ void krt_io_init(void);
 
 void log_init_debug(char *);		/* Initialize debug dump to given file (NULL=stderr, ""=off) */
 void log_switch(int debug, list *l, char *); /* Use l=NULL for initial switch */
+void log_init_async(void);		/* Queue messages, io_loop() calls log_flush() */
 
 struct log_config {
   node n;